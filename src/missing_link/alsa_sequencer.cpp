@@ -0,0 +1,239 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <alsa/asoundlib.h>
+#include "missing_link/alsa_sequencer.hpp"
+
+using namespace MissingLink;
+
+namespace MissingLink {
+
+  static int eventType(unsigned char status) {
+    switch (status) {
+      case 0xF8: return SND_SEQ_EVENT_CLOCK;
+      case 0xFA: return SND_SEQ_EVENT_START;
+      case 0xFB: return SND_SEQ_EVENT_CONTINUE;
+      case 0xFC: return SND_SEQ_EVENT_STOP;
+      default:   return -1;
+    }
+  }
+
+}
+
+AlsaSequencer::AlsaSequencer(HostClock hostClock)
+  : m_hostClock(hostClock)
+  , m_pSeq(nullptr)
+  , m_client(-1)
+  , m_port(-1)
+  , m_queue(-1)
+{
+  open();
+}
+
+AlsaSequencer::~AlsaSequencer() {
+  close();
+}
+
+int AlsaSequencer::ConnectOutputs() {
+  // m_client and m_port don't change once open
+  if (!m_pSeq) { return 0; }
+
+  snd_seq_t *pSeq;
+  int result;
+  if ((result = snd_seq_open(&pSeq, "default", SND_SEQ_OPEN_OUTPUT, 0)) < 0) {
+    std::cerr << "Failed to open ALSA sequencer to connect ports: " << snd_strerror(result) << std::endl;
+    return 0;
+  }
+
+  snd_seq_addr_t sender;
+  sender.client = m_client;
+  sender.port = m_port;
+  snd_seq_port_subscribe_t *subscription;
+  snd_seq_port_subscribe_alloca(&subscription);
+  snd_seq_port_subscribe_set_sender(subscription, &sender);
+
+  int connected = 0;
+  snd_seq_client_info_t *clientInfo;
+  snd_seq_port_info_t *portInfo;
+  snd_seq_client_info_alloca(&clientInfo);
+  snd_seq_port_info_alloca(&portInfo);
+
+  snd_seq_client_info_set_client(clientInfo, -1);
+  while (snd_seq_query_next_client(pSeq, clientInfo) >= 0) {
+    const int client = snd_seq_client_info_get_client(clientInfo);
+    if (client == m_client || client == SND_SEQ_CLIENT_SYSTEM) { continue; }
+
+    snd_seq_port_info_set_client(portInfo, client);
+    snd_seq_port_info_set_port(portInfo, -1);
+    while (snd_seq_query_next_port(pSeq, portInfo) >= 0) {
+      const unsigned int caps = SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE;
+      if ((snd_seq_port_info_get_capability(portInfo) & caps) != caps) { continue; }
+      if ((snd_seq_port_info_get_type(portInfo) & SND_SEQ_PORT_TYPE_MIDI_GENERIC) == 0) { continue; }
+
+      // Our port takes subscriptions from anyone, like aconnect makes them
+      snd_seq_port_subscribe_set_dest(subscription, snd_seq_port_info_get_addr(portInfo));
+      const int result = snd_seq_subscribe_port(pSeq, subscription);
+      // -EBUSY means we are already connected
+      if (result == 0 || result == -EBUSY) {
+        connected++;
+      } else {
+        std::cerr << "Failed to connect MIDI sequencer to " << snd_seq_port_info_get_name(portInfo)
+                  << ": " << snd_strerror(result) << std::endl;
+      }
+    }
+  }
+  snd_seq_close(pSeq);
+  return connected;
+}
+
+bool AlsaSequencer::Schedule(unsigned char status, std::chrono::microseconds time) {
+  ScopedMutex lock(m_mutex);
+  if (!m_pSeq) { return false; }
+  return output(status, true, toQueueTime(time));
+}
+
+bool AlsaSequencer::SendNow(unsigned char status) {
+  ScopedMutex lock(m_mutex);
+  if (!m_pSeq) { return false; }
+  return output(status, false, std::chrono::microseconds(0));
+}
+
+void AlsaSequencer::CancelScheduled() {
+  ScopedMutex lock(m_mutex);
+  if (!m_pSeq) { return; }
+  snd_seq_remove_events_t *remove;
+  snd_seq_remove_events_alloca(&remove);
+  std::memset(remove, 0, snd_seq_remove_events_sizeof());
+  snd_seq_remove_events_set_condition(remove, SND_SEQ_REMOVE_OUTPUT);
+  snd_seq_remove_events_set_queue(remove, m_queue);
+  const int result = snd_seq_remove_events(m_pSeq, remove);
+  if (result < 0) {
+    std::cerr << "Failed to remove scheduled MIDI events: " << snd_strerror(result) << std::endl;
+  }
+}
+
+void AlsaSequencer::open() {
+  int result;
+  if ((result = snd_seq_open(&m_pSeq, "default", SND_SEQ_OPEN_OUTPUT, 0)) < 0) {
+    std::cerr << "Failed to open ALSA sequencer: " << snd_strerror(result) << std::endl;
+    m_pSeq = nullptr;
+    return;
+  }
+  snd_seq_set_client_name(m_pSeq, "Missing Link");
+  m_client = snd_seq_client_id(m_pSeq);
+
+  m_port = snd_seq_create_simple_port(m_pSeq, "Clock Out",
+      SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+      SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+  if (m_port < 0) {
+    std::cerr << "Failed to create MIDI sequencer port: " << snd_strerror(m_port) << std::endl;
+    close();
+    return;
+  }
+
+  m_queue = snd_seq_alloc_named_queue(m_pSeq, "Missing Link Clock");
+  if (m_queue < 0) {
+    std::cerr << "Failed to allocate MIDI sequencer queue: " << snd_strerror(m_queue) << std::endl;
+    close();
+    return;
+  }
+
+  useHighResolutionTimer();
+
+  const auto before = m_hostClock();
+  snd_seq_start_queue(m_pSeq, m_queue, nullptr);
+  snd_seq_drain_output(m_pSeq);
+  const auto after = m_hostClock();
+  // Queue real time starts from zero, refined later by toQueueTime()
+  m_queueOffset.Sync(before + (after - before) / 2);
+}
+
+void AlsaSequencer::close() {
+  if (!m_pSeq) { return; }
+  if (m_queue >= 0) {
+    snd_seq_stop_queue(m_pSeq, m_queue, nullptr);
+    snd_seq_drain_output(m_pSeq);
+    snd_seq_free_queue(m_pSeq, m_queue);
+    m_queue = -1;
+  }
+  snd_seq_close(m_pSeq);
+  m_pSeq = nullptr;
+}
+
+void AlsaSequencer::useHighResolutionTimer() {
+  // The default system timer ticks at HZ, far too coarse for MIDI clock
+  snd_seq_queue_timer_t *timer;
+  snd_timer_id_t *timerId;
+  snd_seq_queue_timer_alloca(&timer);
+  snd_timer_id_alloca(&timerId);
+
+  snd_seq_get_queue_timer(m_pSeq, m_queue, timer);
+  snd_timer_id_set_class(timerId, SND_TIMER_CLASS_GLOBAL);
+  snd_timer_id_set_sclass(timerId, SND_TIMER_SCLASS_NONE);
+  snd_timer_id_set_card(timerId, -1);
+  snd_timer_id_set_device(timerId, SND_TIMER_GLOBAL_HRTIMER);
+  snd_timer_id_set_subdevice(timerId, 0);
+  snd_seq_queue_timer_set_id(timer, timerId);
+
+  const int result = snd_seq_set_queue_timer(m_pSeq, m_queue, timer);
+  if (result < 0) {
+    std::cerr << "MIDI sequencer queue has no hrtimer, using the default timer: "
+              << snd_strerror(result) << std::endl;
+  }
+}
+
+bool AlsaSequencer::output(unsigned char status, bool scheduled, std::chrono::microseconds queueTime) {
+  const int type = eventType(status);
+  if (type < 0) { return false; }
+
+  snd_seq_event_t event;
+  snd_seq_ev_clear(&event);
+  snd_seq_ev_set_source(&event, m_port);
+  snd_seq_ev_set_subs(&event);
+  event.type = type;
+
+  int result;
+  if (scheduled) {
+    const auto secs = std::chrono::duration_cast<std::chrono::seconds>(queueTime);
+    snd_seq_real_time_t time;
+    time.tv_sec = (unsigned int)std::max<long long>(0, secs.count());
+    time.tv_nsec = (unsigned int)std::max<long long>(0, (queueTime - secs).count() * 1000);
+    snd_seq_ev_schedule_real(&event, m_queue, 0, &time);
+    if ((result = snd_seq_event_output(m_pSeq, &event)) >= 0) {
+      result = snd_seq_drain_output(m_pSeq);
+    }
+  } else {
+    snd_seq_ev_set_direct(&event);
+    result = snd_seq_event_output_direct(m_pSeq, &event);
+  }
+
+  if (result < 0) {
+    std::cerr << "Failed to send MIDI sequencer event: " << snd_strerror(result) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::chrono::microseconds AlsaSequencer::toQueueTime(std::chrono::microseconds hostTime) {
+  if (m_queueOffset.IsSyncDue()) {
+    snd_seq_queue_status_t *status;
+    snd_seq_queue_status_alloca(&status);
+    const auto before = m_hostClock();
+    const int result = snd_seq_get_queue_status(m_pSeq, m_queue, status);
+    const auto after = m_hostClock();
+
+    if (result >= 0) {
+      const snd_seq_real_time_t *queueNow = snd_seq_queue_status_get_real_time(status);
+      const auto queueTime = std::chrono::seconds(queueNow->tv_sec) +
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(queueNow->tv_nsec));
+      m_queueOffset.Sync(before + (after - before) / 2 - queueTime);
+    }
+  }
+  return hostTime - std::chrono::duration_cast<std::chrono::microseconds>(m_queueOffset.Get());
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include "missing_link/types.hpp"
+#include "missing_link/host_clock.hpp"
+#include "missing_link/event_clock.hpp"
+
+struct _snd_seq;
+
+namespace MissingLink {
+
+// ALSA sequencer client with its own queue, so MIDI realtime messages can
+// be handed to the kernel ahead of time and delivered at their timestamp
+// instead of whenever a user-space thread gets around to sending them.
+// Safe to use from several threads. Scheduling and sending are realtime
+// safe as far as ALSA is: they only ever wait for each other, for the
+// length of one event. Connecting ports never holds them up.
+class AlsaSequencer {
+
+  public:
+
+    AlsaSequencer(HostClock hostClock);
+    virtual ~AlsaSequencer();
+
+    bool IsOpen() const { return m_pSeq != nullptr; }
+
+    // Subscribe every writable MIDI port of other clients to our output
+    // port. Safe to repeat, existing connections are kept. Enumerates and
+    // subscribes through a handle of its own, without taking the lock the
+    // realtime callers use.
+    int ConnectOutputs();
+
+    // Deliver a single byte realtime message (0xF8, 0xFA, 0xFC) at the
+    // given Link host time. Times in the past are delivered right away.
+    bool Schedule(unsigned char status, std::chrono::microseconds time);
+
+    // Deliver a message right away, bypassing the queue
+    bool SendNow(unsigned char status);
+
+    // Drop everything scheduled that has not been delivered yet
+    void CancelScheduled();
+
+  private:
+
+    void open();
+    void close();
+    void useHighResolutionTimer();
+    bool output(unsigned char status, bool scheduled, std::chrono::microseconds queueTime);
+    std::chrono::microseconds toQueueTime(std::chrono::microseconds hostTime);
+
+    HostClock m_hostClock;
+
+    _snd_seq *m_pSeq;
+    int m_client;
+    int m_port;
+    int m_queue;
+
+    // Taken by the edge planner and MIDI sender threads, nothing else
+    std::mutex m_mutex;
+
+    // Host time minus queue time, tracked so the two clocks can't drift apart
+    ClockOffset m_queueOffset;
+};
+
+}
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace MissingLink {
+
+// Perceived brightness (0 - 1) to the 8-bit PWM value giving it, gamma 2.2.
+// Levels in animations are perceptual, so equal steps look equal and a
+// fade doesn't jump out of black and then stall near full brightness.
+uint8_t GammaCorrect(float level);
+
+// Levels of every channel at one position of an animation. Positions are
+// in whatever the animation is driven by: phase for the ring, seconds for
+// the Wi-Fi LED. Two keyframes at the same position make a hard step.
+template <int Channels>
+struct Keyframe {
+  float position;
+  float levels[Channels];
+};
+
+// Plays a constant keyframe table, interpolating linearly between the two
+// keyframes around the position. The table isn't copied, each instance
+// only keeps the segment the last frame was in, so the next frame is
+// found in a step or two and nothing is ever allocated. Positions loop
+// over the length of the table, from 0 to the last keyframe.
+template <int Channels>
+class Animation {
+
+  public:
+
+    template <std::size_t Count>
+    Animation(const Keyframe<Channels> (&keyframes)[Count])
+      : m_keyframes(keyframes)
+      , m_count((int)Count)
+      , m_cursor(0)
+    {
+      static_assert(Count >= 2, "An animation needs at least two keyframes");
+    }
+
+    float GetLength() const { return m_keyframes[m_count - 1].position; }
+
+    // Levels of all channels at the position
+    void Render(float position, float levels[Channels]) {
+      const float length = GetLength();
+      if (length > 0) {
+        position = std::fmod(position, length);
+        if (position < 0) { position += length; }
+      }
+
+      // Positions only move forward, except when looping around
+      if (position < m_keyframes[m_cursor].position) {
+        m_cursor = 0;
+      }
+      while (m_cursor < m_count - 2 && m_keyframes[m_cursor + 1].position <= position) {
+        m_cursor++;
+      }
+
+      const Keyframe<Channels> &from = m_keyframes[m_cursor];
+      const Keyframe<Channels> &to = m_keyframes[m_cursor + 1];
+      const float span = to.position - from.position;
+      float t = span > 0 ? (position - from.position) / span : 1;
+      t = t < 0 ? 0 : (t > 1 ? 1 : t);
+      for (int i = 0; i < Channels; i++) {
+        levels[i] = from.levels[i] + (to.levels[i] - from.levels[i]) * t;
+      }
+    }
+
+    // Start over from the first keyframe
+    void Rewind() { m_cursor = 0; }
+
+  private:
+
+    const Keyframe<Channels> *m_keyframes;
+    int m_count;
+    int m_cursor;   // keyframe the last rendered segment starts at
+};
+
+}
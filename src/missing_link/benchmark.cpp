@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <sys/resource.h>
+#include "missing_link/hw_defs.h"
+#include "missing_link/engine.hpp"
+#include "missing_link/simulator.hpp"
+#include "missing_link/benchmark.hpp"
+
+using namespace MissingLink;
+
+namespace {
+
+  // Time for the outputs to pick up new settings before measuring
+  const std::chrono::milliseconds SettleTime(250);
+
+  struct Usage {
+    double cpuMicros;
+    long contextSwitches;
+  };
+
+  Usage getUsage() {
+    rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return {
+      usage.ru_utime.tv_sec * 1.0e6 + usage.ru_utime.tv_usec +
+        usage.ru_stime.tv_sec * 1.0e6 + usage.ru_stime.tv_usec,
+      usage.ru_nvcsw + usage.ru_nivcsw
+    };
+  }
+
+}
+
+const std::vector<double> Benchmark::s_tempos({ 60.0, 120.0, 200.0, 300.0 });
+
+Benchmark::Benchmark(std::chrono::milliseconds window, std::ostream &report)
+  : m_window(window)
+  , m_report(report)
+{}
+
+bool Benchmark::Run() {
+  if (!Hardware::IsSimulated()) {
+    std::cerr << "Benchmark needs the simulated hardware backend" << std::endl;
+    return false;
+  }
+
+  Engine engine;
+  std::thread engineThread([&engine]() { engine.Run(); });
+
+  auto pStats = engine.GetOutputStats();
+  Simulator &simulator = Simulator::Get();
+  const Settings defaults = engine.GetSettings();
+  bool passed = true;
+
+  engine.Play();
+  printHeader();
+
+  for (double tempo : s_tempos) {
+    for (size_t ppqnIndex = 0; ppqnIndex < Settings::ppqn_options.size(); ppqnIndex++) {
+      for (int resetMode = 0; resetMode < 3; resetMode++) {
+        Settings settings = defaults;
+        settings.tempo = tempo;
+        settings.ppqn_index = ppqnIndex;
+        settings.reset_mode = resetMode;
+        engine.ApplySettings(settings);
+        std::this_thread::sleep_for(SettleTime);
+
+        pStats->Reset();
+        const uint32_t edgesBefore = simulator.GetPin(ML_CLOCK_PIN).risingEdges.load();
+        const uint64_t callsBefore = simulator.GetDeviceCalls();
+        const Usage usageBefore = getUsage();
+        const auto start = Clock::now();
+
+        std::this_thread::sleep_for(m_window);
+
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        const Usage usageAfter = getUsage();
+        const auto clockLatency = pStats->clockLatency.GetSummary();
+
+        Result result;
+        result.tempo = tempo;
+        result.ppqn = settings.getPPQN();
+        result.resetMode = resetMode;
+        result.expectedEdges = seconds * tempo / 60.0 * settings.channels[0].getTicksPerBeat(result.ppqn);
+        result.clockEdges = simulator.GetPin(ML_CLOCK_PIN).risingEdges.load() - edgesBefore;
+        result.latencyP50 = clockLatency.p50.count();
+        result.latencyP99 = clockLatency.p99.count();
+        result.latencyMax = clockLatency.max.count();
+        // Late edges, plus any that never made it out at all. The window
+        // can cut a tick either way, so allow one edge of slack.
+        const double dropped = std::floor(result.expectedEdges) - 1.0 - result.clockEdges;
+        result.missedEdges = pStats->missedEdges.load() + (uint32_t)std::max(0.0, dropped);
+        result.mergedEdges = pStats->mergedEdges.load();
+        result.loopOverruns = pStats->loopOverruns.load();
+        result.cpuPerTick = (usageAfter.cpuMicros - usageBefore.cpuMicros) / std::max(1u, result.clockEdges);
+        result.deviceCallsPerSec = (simulator.GetDeviceCalls() - callsBefore) / seconds;
+        result.contextSwitchesPerSec = (usageAfter.contextSwitches - usageBefore.contextSwitches) / seconds;
+
+        printResult(result);
+        if (result.missedEdges > 0) {
+          passed = false;
+        }
+      }
+    }
+  }
+
+  engine.Stop();
+  engineThread.join();
+
+  m_report << (passed ? "PASS" : "FAIL: missed edges") << std::endl;
+  return passed;
+}
+
+void Benchmark::printHeader() {
+  m_report << "Window " << m_window.count() << "ms per combination, latency in us\n"
+           << "  bpm ppqn rst  edges/expected   p50   p99   max  miss merge over  cpu/tick  dev/s  ctx/s\n";
+}
+
+void Benchmark::printResult(const Result &result) {
+  m_report << std::fixed
+           << std::setw(5) << std::setprecision(0) << result.tempo
+           << std::setw(5) << result.ppqn
+           << std::setw(4) << result.resetMode
+           << std::setw(7) << result.clockEdges << "/"
+           << std::setw(8) << std::setprecision(1) << result.expectedEdges
+           << std::setw(6) << result.latencyP50
+           << std::setw(6) << result.latencyP99
+           << std::setw(6) << result.latencyMax
+           << std::setw(6) << result.missedEdges
+           << std::setw(6) << result.mergedEdges
+           << std::setw(5) << result.loopOverruns
+           << std::setw(10) << std::setprecision(1) << result.cpuPerTick
+           << std::setw(7) << std::setprecision(0) << result.deviceCallsPerSec
+           << std::setw(7) << result.contextSwitchesPerSec
+           << std::endl;
+}
@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace MissingLink {
+
+// Runs the Engine against the simulated hardware across every
+// tempo x PPQN x reset mode combination and reports output timing.
+// Needs the simulated backend, see hardware.hpp.
+class Benchmark {
+
+  public:
+
+    Benchmark(std::chrono::milliseconds window, std::ostream &report);
+
+    // Returns false if any combination missed edges
+    bool Run();
+
+  private:
+
+    struct Result {
+      double tempo;
+      int ppqn;
+      int resetMode;
+      double expectedEdges;
+      uint32_t clockEdges;
+      uint32_t latencyP50;
+      uint32_t latencyP99;
+      uint32_t latencyMax;
+      uint32_t missedEdges;
+      uint32_t mergedEdges;
+      uint32_t loopOverruns;
+      double cpuPerTick;          // microseconds of CPU, all threads, per clock edge
+      double deviceCallsPerSec;   // pin, I2C and MIDI operations per second
+      double contextSwitchesPerSec;
+    };
+
+    static const std::vector<double> s_tempos;
+
+    void printHeader();
+    void printResult(const Result &result);
+
+    const std::chrono::milliseconds m_window;
+    std::ostream &m_report;
+};
+
+}
@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <iostream>
+#include <poll.h>
+#include "missing_link/hw_defs.h"
+#include "missing_link/clock_input.hpp"
+
+using namespace MissingLink;
+
+namespace MissingLink {
+
+  // Edges closer than this are contact bounce or noise, not clock
+  static const std::chrono::microseconds MinClockInInterval(1000);
+
+  // A clock that stops for this long starts over when it comes back
+  static const std::chrono::microseconds ClockInTimeout(2000000);
+
+  // Bounds how often the tracked clock is committed to the Link session
+  static const std::chrono::microseconds ClockInReportInterval(100000);
+
+}
+
+ClockInputProcess::ClockInputProcess(Engine &engine)
+  : Engine::Process(engine, std::chrono::microseconds(0))
+  , m_pClockIn(std::unique_ptr<GPIO::LineEvents>(new GPIO::LineEvents(ML_GPIO_CHIP, ML_CLOCK_IN_PIN, GPIO::Pin::RISING)))
+  , m_ppqn(0)
+  , m_eventClock([&engine]() { return engine.GetHostTime(); })
+  , m_lastEdge(0)
+  , m_lastReport(0)
+{}
+
+void ClockInputProcess::process() {
+  if (!m_pClockIn->IsOpen()) {
+    // Nothing to follow, e.g. when simulated
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    return;
+  }
+
+  pollfd pfd = m_pClockIn->GetPollInfo();
+  // Time out now and then so Stop() is noticed
+  if (::poll(&pfd, 1, 100) <= 0) { return; }
+
+  std::chrono::nanoseconds timestamp;
+  bool rising;
+  while (m_pClockIn->Read(timestamp, rising)) {
+    if (rising) {
+      receive(timestamp);
+    }
+  }
+}
+
+void ClockInputProcess::receive(std::chrono::nanoseconds timestamp) {
+  const auto settings = m_engine.GetSettings();
+  if (settings.clock_source != ClockSource::Analog) {
+    m_pTracker.reset();
+    return;
+  }
+
+  const int ppqn = settings.getPPQN();
+  const auto time = m_eventClock.ToHostTime(timestamp);
+  const auto interval = time - m_lastEdge;
+  if (interval < MinClockInInterval && interval >= std::chrono::microseconds(0)) {
+    return;
+  }
+  m_lastEdge = time;
+
+  if (!m_pTracker || ppqn != m_ppqn || interval >= ClockInTimeout) {
+    // Start over, the old period means nothing at a new PPQN or after a pause
+    m_pTracker = std::unique_ptr<TempoTracker>(new TempoTracker(ppqn));
+    m_ppqn = ppqn;
+  }
+  m_pTracker->Tick(time);
+
+  if (m_pTracker->IsLocked() && time - m_lastReport >= ClockInReportInterval && onClock) {
+    m_lastReport = time;
+    ExternalClock clock;
+    clock.tempo = m_pTracker->GetTempo();
+    clock.beat = m_pTracker->GetBeat();
+    clock.positioned = false;
+    clock.ticksPerBeat = ppqn;
+    clock.time = m_pTracker->GetTickTime();
+    onClock(clock);
+  }
+}
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include "missing_link/engine.hpp"
+#include "missing_link/event_clock.hpp"
+#include "missing_link/gpio.hpp"
+#include "missing_link/tempo_tracker.hpp"
+
+namespace MissingLink {
+
+  // Follows pulses on the analog clock input at the configured PPQN. Edges
+  // come from the GPIO character device with kernel timestamps, so the
+  // tempo and phase estimate don't see any scheduling latency.
+  class ClockInputProcess : public Engine::Process {
+
+    public:
+
+      ClockInputProcess(Engine &engine);
+
+      // Tracked clock once locked, a few times a second.
+      // Called from the clock input thread.
+      std::function<void(const ExternalClock&)> onClock;
+
+    private:
+
+      void process() override;
+      void receive(std::chrono::nanoseconds timestamp);
+
+      std::unique_ptr<GPIO::LineEvents> m_pClockIn;
+      std::unique_ptr<TempoTracker> m_pTracker;
+      int m_ppqn;
+
+      // Kernel event timestamps are on a different clock than Link
+      EventClock m_eventClock;
+
+      std::chrono::microseconds m_lastEdge;
+      std::chrono::microseconds m_lastReport;
+  };
+
+}
@@ -4,6 +4,7 @@
  */
 
 #include <iostream>
+#include <algorithm>
 #include <cmath>
 #include <bitset>
 #include "missing_link/control.hpp"
@@ -13,6 +14,55 @@ using namespace MissingLink;
 
 namespace MissingLink {
   typedef std::chrono::milliseconds Millis;
+
+  // Quadrature step for each transition, indexed by the previous and the
+  // new state with A and B as bits 1 and 0. A leading B counts up. Both
+  // bits changing at once means a state was missed and the direction is
+  // unknown, those count for nothing.
+  static constexpr int8_t QuadratureSteps[16] = {
+  //  to 00  01  10  11
+           0, -1,  1,  0,   // from 00
+           1,  0,  0, -1,   // from 01
+          -1,  0,  0,  1,   // from 10
+           0,  1, -1,  0    // from 11
+  };
+
+  // Gray code position of a state, 00 -> 10 -> 11 -> 01 counting up
+  static constexpr int quadraturePosition(int state) {
+    return state == 0b00 ? 0 : state == 0b10 ? 1 : state == 0b11 ? 2 : 3;
+  }
+
+  static constexpr int quadratureStep(int from, int to) {
+    return ((quadraturePosition(to) - quadraturePosition(from) + 4) % 4) == 1 ? 1 :
+           ((quadraturePosition(to) - quadraturePosition(from) + 4) % 4) == 3 ? -1 : 0;
+  }
+
+  static constexpr bool quadratureTableValid(int index) {
+    return index == 16 ||
+      (QuadratureSteps[index] == quadratureStep(index >> 2, index & 0b11) && quadratureTableValid(index + 1));
+  }
+
+  static_assert(quadratureTableValid(0), "Quadrature table doesn't match the Gray code sequence");
+
+  // One detent of the encoder is a full quadrature cycle, from and back to
+  // the rest state with both contacts open, read as 00 through the
+  // inverted inputs
+  static const int StepsPerDetent = 4;
+  static const int DetentRestState = 0b00;
+
+  // A detent this long after the last one starts a new gesture
+  static const std::chrono::microseconds EncoderGestureTimeout(200000);
+
+  // Weight of each detent in the smoothed velocity
+  static const float EncoderVelocitySmoothing = 0.4;
+
+  // Sweeping the whole tempo range takes about one turn at full speed
+  static const RotaryEncoder::Acceleration DefaultEncoderAcceleration = {
+    .minSpeed = 5.0,
+    .maxSpeed = 30.0,
+    .maxGain  = 12.0,
+    .exponent = 1.5
+  };
 }
 
 Control::Control(vector<int> pinIndices)
@@ -24,32 +74,33 @@ Control::Control(vector<int> pinIndices)
 
 Control::~Control() {}
 
-void Control::HandleInterrupt(uint8_t flag, uint8_t state, shared_ptr<IOExpander> pExpander) {
-  handleInterrupt(flag, state, pExpander);
+void Control::HandleInterrupt(const IOExpander::InterruptState &interrupt, std::chrono::microseconds time,
+    shared_ptr<IOExpander> pExpander) {
+  handleInterrupt(interrupt, time, pExpander);
 }
 
 Button::Button(int pinIndex) : Control({ pinIndex }) {}
 
 Button::~Button() {}
 
-void Button::handleInterrupt(uint8_t flag, uint8_t state, shared_ptr<IOExpander> pExpander) {
+void Button::handleInterrupt(const IOExpander::InterruptState &interrupt, std::chrono::microseconds time,
+    shared_ptr<IOExpander> pExpander) {
 
-  auto now = Clock::now();
-  Millis tDiff = std::chrono::duration_cast<Millis>(now - m_lastEvent);
+  Millis tDiff = std::chrono::duration_cast<Millis>(time - m_lastEvent);
 
-  const bool isDown = ((flag & state) != 0);
+  const bool isDown = ((interrupt.flag & interrupt.current) != 0);
   if (isDown == m_bIsDown) { return; }
 
   // Debounce (maybe unnecessary)
   if (tDiff < Millis(10)) { return; }
 
-  m_lastEvent = now;
+  m_lastEvent = time;
   m_bIsDown = isDown;
 
   if (isDown && onButtonDown) {
-    onButtonDown();
+    onButtonDown(time);
   } else if (!isDown && onButtonUp) {
-    onButtonUp();
+    onButtonUp(time);
   }
 }
 
@@ -58,69 +109,68 @@ RotaryEncoder::RotaryEncoder(int pinIndexA, int pinIndexB)
   : Control({ pinIndexA, pinIndexB })
   , m_aFlag(1 << pinIndexA)
   , m_bFlag(1 << pinIndexB)
-  , m_encVal(0)
-  , m_lastEncSeq(0)
+  , m_acceleration(DefaultEncoderAcceleration)
+  , m_lastState(0)
+  , m_steps(0)
+  , m_direction(0)
+  , m_speed(0.0)
+  , m_lastDetent(0)
 {}
 
 RotaryEncoder::~RotaryEncoder() {}
 
-void RotaryEncoder::handleInterrupt(uint8_t flag, uint8_t state, shared_ptr<IOExpander> pExpander) {
-  bool aOn = (m_aFlag & state) != 0;
-  bool bOn = (m_bFlag & state) != 0;
-  decode(aOn, bOn);
+void RotaryEncoder::SetAcceleration(const Acceleration &acceleration) {
+  m_acceleration = acceleration;
 }
 
-void RotaryEncoder::decode(bool aOn, bool bOn) {
-
-  auto now = Clock::now();
-
-  uint8_t aVal = aOn ? 0x01 : 0x00;
-  uint8_t bVal = bOn ? 0x01 : 0x00;
-
-  unsigned int seq = (aVal ^ bVal) | (bVal << 1);
-  if (seq == m_lastEncSeq) { return; }
-
-  unsigned int delta = (seq - m_lastEncSeq) & 0b11;
-
-  m_lastEncSeq = seq;
-
-  switch (delta) {
-    case 1:
-      m_encVal++;
-      break;
-    case 3:
-      m_encVal--;
-      break;
-    default:
-      break;
-  }
-
-  if (std::abs(m_encVal) < 4) {
-    return;
-  }
-
-  float acc = 1.0;
-  float rotationAmount = 0.0;
-
-  const float accThreshold = 50.0;
-  float interval = (float)std::chrono::duration_cast<Millis>(now - m_lastChange).count();
+void RotaryEncoder::handleInterrupt(const IOExpander::InterruptState &interrupt, std::chrono::microseconds time,
+    shared_ptr<IOExpander> pExpander) {
+  decode((m_aFlag & interrupt.captured) != 0, (m_bFlag & interrupt.captured) != 0, time);
+  decode((m_aFlag & interrupt.current) != 0, (m_bFlag & interrupt.current) != 0, time);
+}
 
-  if (interval <= accThreshold && interval > 0) {
-    float factor = fmin(1.0, fmax(0.0, (accThreshold - interval)/accThreshold));
-    acc += factor * 4.0;
+void RotaryEncoder::decode(bool aOn, bool bOn, std::chrono::microseconds time) {
+  const int state = (aOn ? 0b10 : 0) | (bOn ? 0b01 : 0);
+  const int step = QuadratureSteps[(m_lastState << 2) | state];
+  m_lastState = state;
+
+  m_steps += step;
+  if (state == DetentRestState) {
+    // Back at rest the encoder sits on a detent, whatever was counted on
+    // the way. A transition missed in between, e.g. while the interrupt
+    // was being read, leaves the count short, so at least half a cycle
+    // is a detent, and the count starts over either way instead of
+    // carrying the error into the next one.
+    if (m_steps >= StepsPerDetent / 2) {
+      detent(1, time);
+    } else if (m_steps <= -StepsPerDetent / 2) {
+      detent(-1, time);
+    }
+    m_steps = 0;
   }
+}
 
-  m_lastChange = now;
+void RotaryEncoder::detent(int direction, std::chrono::microseconds time) {
+  const auto interval = time - m_lastDetent;
+  m_lastDetent = time;
 
-  if (m_encVal > 0) {
-    rotationAmount = 1.0 * acc;
+  if (direction != m_direction || interval >= EncoderGestureTimeout || interval <= std::chrono::microseconds(0)) {
+    // A pause or a change of direction starts a new gesture at the lowest gain
+    m_direction = direction;
+    m_speed = 0.0;
   } else {
-    rotationAmount = -1.0 * acc;
+    const float speed = 1.0e6 / (float)interval.count();
+    m_speed += EncoderVelocitySmoothing * (speed - m_speed);
   }
 
-  m_encVal = 0;
+  const Acceleration &acc = m_acceleration;
+  float gain = 1.0;
+  if (acc.maxGain > 1.0 && acc.maxSpeed > acc.minSpeed) {
+    const float x = std::min(1.0f, std::max(0.0f, (m_speed - acc.minSpeed) / (acc.maxSpeed - acc.minSpeed)));
+    gain += (acc.maxGain - 1.0) * std::pow(x, acc.exponent);
+  }
 
   if (onRotated) {
-    onRotated(rotationAmount);
+    onRotated(direction * gain);
   }
 }
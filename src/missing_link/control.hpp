@@ -25,14 +25,15 @@ class Control {
       return (flag & m_flagMask) != 0;
     }
 
-    void HandleInterrupt(uint8_t flag,
-                         uint8_t state,
+    // time is the host time of the interrupt
+    void HandleInterrupt(const IOExpander::InterruptState &interrupt,
+                         std::chrono::microseconds time,
                          std::shared_ptr<IOExpander> pExpander);
 
   protected:
 
-    virtual void handleInterrupt(uint8_t flag,
-                                 uint8_t state,
+    virtual void handleInterrupt(const IOExpander::InterruptState &interrupt,
+                                 std::chrono::microseconds time,
                                  std::shared_ptr<IOExpander> pExpander) = 0;
     uint8_t m_flagMask = 0;
 };
@@ -45,18 +46,18 @@ class Button : public Control {
 
     virtual ~Button();
 
-    // Press down detected once.
-    std::function<void(void)> onButtonDown;
+    // Press down detected once. Gets the host time of the press.
+    std::function<void(std::chrono::microseconds)> onButtonDown;
 
     // Release up detected once
-    std::function<void(void)> onButtonUp;
+    std::function<void(std::chrono::microseconds)> onButtonUp;
 
   private:
 
-    TimePoint m_lastEvent;
+    std::chrono::microseconds m_lastEvent = std::chrono::microseconds(0);
     bool m_bIsDown = false;
-    void handleInterrupt(uint8_t flag,
-                         uint8_t state,
+    void handleInterrupt(const IOExpander::InterruptState &interrupt,
+                         std::chrono::microseconds time,
                          std::shared_ptr<IOExpander> pExpander) override;
 };
 
@@ -64,11 +65,21 @@ class RotaryEncoder : public Control {
 
   public:
 
+    // Gain on each detent by how fast the encoder is turning
+    struct Acceleration {
+      float minSpeed;   // detents per second where acceleration starts...
+      float maxSpeed;   // ...and where it reaches maxGain
+      float maxGain;    // 1 turns acceleration off
+      float exponent;   // above 1 keeps moderate speeds fine grained
+    };
+
     RotaryEncoder(int pinIndexA, int pinIndexB);
     virtual ~RotaryEncoder();
 
-    // Float indicates rotation amount (1.0 == one notch up, -1.0 == one notch down)
-    // TODO: account for speed/acceleration
+    void SetAcceleration(const Acceleration &acceleration);
+
+    // Float indicates rotation amount (1.0 == one notch up, -1.0 == one notch down),
+    // scaled up by the acceleration when turned quickly
     std::function<void(float)> onRotated;
 
   private:
@@ -76,15 +87,21 @@ class RotaryEncoder : public Control {
     uint8_t m_aFlag;
     uint8_t m_bFlag;
 
-    long m_encVal;
-    unsigned int m_lastEncSeq;
-    TimePoint m_lastChange;
-
-    void handleInterrupt(uint8_t flag,
-                         uint8_t state,
+    Acceleration m_acceleration;
+    int m_lastState;      // A and B as bits 1 and 0
+    int m_steps;          // quadrature steps since the encoder was last at rest
+    int m_direction;      // of the current gesture, 0 before the first one
+    float m_speed;        // smoothed detents per second in that direction
+    std::chrono::microseconds m_lastDetent;
+
+    // Decodes the state captured at the interrupt, then the one read
+    // after it, so a step taken in between isn't lost
+    void handleInterrupt(const IOExpander::InterruptState &interrupt,
+                         std::chrono::microseconds time,
                          std::shared_ptr<IOExpander> pExpander) override;
 
-    void decode(bool aOn, bool bOn);
+    void decode(bool aOn, bool bOn, std::chrono::microseconds time);
+    void detent(int direction, std::chrono::microseconds time);
 };
 
 }
@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include "missing_link/deadline_timer.hpp"
+
+using namespace MissingLink;
+
+DeadlineTimer::DeadlineTimer()
+  : m_timerFd(-1)
+  , m_eventFd(-1)
+{
+  open();
+}
+
+DeadlineTimer::~DeadlineTimer() {
+  close();
+}
+
+std::chrono::nanoseconds DeadlineTimer::Now() {
+  timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+bool DeadlineTimer::WaitUntil(std::chrono::nanoseconds deadline) {
+  if (!IsValid()) { return false; }
+
+  const auto secs = std::chrono::duration_cast<std::chrono::seconds>(deadline);
+  itimerspec spec;
+  std::memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = secs.count();
+  spec.it_value.tv_nsec = (deadline - secs).count();
+  // A zero it_value disarms the timer, so never pass exactly zero
+  if (spec.it_value.tv_sec <= 0 && spec.it_value.tv_nsec <= 0) {
+    spec.it_value.tv_nsec = 1;
+  }
+  if (::timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+    std::cerr << "Failed to arm deadline timer: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+
+  pollfd pfds[2] = {
+    { m_timerFd, POLLIN, 0 },
+    { m_eventFd, POLLIN, 0 }
+  };
+
+  int result;
+  do {
+    result = ::poll(pfds, 2, -1);
+  } while (result < 0 && errno == EINTR);
+
+  uint64_t count;
+  if (pfds[0].revents & POLLIN) {
+    ::read(m_timerFd, &count, sizeof(count));
+  }
+  if (pfds[1].revents & POLLIN) {
+    ::read(m_eventFd, &count, sizeof(count));
+    return true;
+  }
+  return false;
+}
+
+void DeadlineTimer::Wake() {
+  if (m_eventFd < 0) { return; }
+  uint64_t one = 1;
+  ::write(m_eventFd, &one, sizeof(one));
+}
+
+void DeadlineTimer::open() {
+  if ((m_timerFd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    std::cerr << "Failed to create timerfd: " << std::strerror(errno) << std::endl;
+  }
+  if ((m_eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+    std::cerr << "Failed to create eventfd: " << std::strerror(errno) << std::endl;
+  }
+}
+
+void DeadlineTimer::close() {
+  if (m_timerFd >= 0) {
+    ::close(m_timerFd);
+    m_timerFd = -1;
+  }
+  if (m_eventFd >= 0) {
+    ::close(m_eventFd);
+    m_eventFd = -1;
+  }
+}
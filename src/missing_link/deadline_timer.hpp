@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <chrono>
+
+namespace MissingLink {
+
+// Blocks a thread until an absolute CLOCK_MONOTONIC deadline (timerfd),
+// or until another thread calls Wake() (eventfd).
+class DeadlineTimer {
+
+  public:
+
+    DeadlineTimer();
+    virtual ~DeadlineTimer();
+
+    // False if the timerfd or eventfd could not be created
+    bool IsValid() const { return m_timerFd >= 0 && m_eventFd >= 0; }
+
+    // Current CLOCK_MONOTONIC time
+    static std::chrono::nanoseconds Now();
+
+    // Sleep until the given CLOCK_MONOTONIC time.
+    // Returns true if woken early by Wake().
+    bool WaitUntil(std::chrono::nanoseconds deadline);
+
+    // Interrupt a pending (or the next) WaitUntil. Safe from any thread.
+    void Wake();
+
+  private:
+
+    int m_timerFd;
+    int m_eventFd;
+
+    void open();
+    void close();
+};
+
+}
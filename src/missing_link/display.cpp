@@ -167,11 +167,22 @@ void SegmentDisplay::Write(std::string const &string) {
   commit();
 }
 
+void SegmentDisplay::WriteGlyphs(const uint16_t glyphs[NumDigits]) {
+  memcpy(m_displayBuffer, glyphs, sizeof(m_displayBuffer));
+  commit();
+}
+
 void SegmentDisplay::Clear() {
   memset(m_displayBuffer, 0, 8);
   commit();
 }
 
+uint16_t SegmentDisplay::Glyph(uint8_t aChar, bool dot) {
+  uint16_t glyph = aChar < 128 ? ASCIILookup[aChar] : 0;
+  if (dot) { glyph |= (1 << 14); }
+  return glyph;
+}
+
 void SegmentDisplay::write(std::string const &string) {
   // get length of string collapsing dot characters
   int rawlen = string.length();
@@ -213,10 +224,42 @@ void SegmentDisplay::writeRaw(uint8_t index, uint16_t bitmask) {
 }
 
 void SegmentDisplay::writeAscii(uint8_t index, uint8_t a, bool dot) {
-  m_displayBuffer[index] = ASCIILookup[a];
-  if (dot) { m_displayBuffer[index] |= (1 << 14); }
+  m_displayBuffer[index] = Glyph(a, dot);
 }
 
 void SegmentDisplay::commit() {
-  m_i2cDevice->WriteBlock(0x00, (uint8_t *)m_displayBuffer, 8);
+  // Most frames repeat the last one, skip the bus transaction for those
+  if (m_shownValid && memcmp(m_shownBuffer, m_displayBuffer, sizeof(m_displayBuffer)) == 0) {
+    return;
+  }
+  m_i2cDevice->WriteBlock(0x00, (uint8_t *)m_displayBuffer, 8, onSent);
+  memcpy(m_shownBuffer, m_displayBuffer, sizeof(m_displayBuffer));
+  m_shownValid = true;
+}
+
+Marquee::Marquee()
+  : m_length(0)
+  , m_offset(0)
+{
+  memset(m_glyphs, 0, sizeof(m_glyphs));
+}
+
+void Marquee::Set(const std::string &message) {
+  memset(m_glyphs, 0, sizeof(m_glyphs));
+  m_length = 0;
+  m_offset = 0;
+  const int rawlen = message.length();
+  for (int offset = 0; offset < rawlen && m_length < MaxGlyphs; offset++) {
+    bool dot = offset < rawlen - 1 && message[offset + 1] == '.';
+    m_glyphs[m_length++] = SegmentDisplay::Glyph(message[offset], dot);
+    if (dot) { offset++; }
+  }
+}
+
+void Marquee::Advance() {
+  m_offset++;
+  // Start over once the last glyph has come into view
+  if (m_offset + SegmentDisplay::NumDigits > m_length) {
+    m_offset = 0;
+  }
 }
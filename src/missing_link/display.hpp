@@ -7,6 +7,7 @@
 
 #include <string>
 #include <memory>
+#include <functional>
 #include "missing_link/hw_defs.h"
 
 namespace MissingLink {
@@ -18,6 +19,8 @@ class SegmentDisplay {
 
   public:
 
+    static const int NumDigits = 4;
+
     SegmentDisplay(uint8_t i2cBus = ML_DEFAULT_I2C_BUS, uint8_t i2cAddress = 0x70);
     virtual ~SegmentDisplay();
 
@@ -25,8 +28,15 @@ class SegmentDisplay {
     void Write(std::string const &string);
     void WriteRaw(uint8_t index, uint16_t bitmask);
     void WriteAscii(uint8_t index, uint8_t aChar, bool dot);
+    void WriteGlyphs(const uint16_t glyphs[NumDigits]);
     void Clear();
 
+    // Segment bitmask for a character, with the decimal point lit if dot
+    static uint16_t Glyph(uint8_t aChar, bool dot);
+
+    // Called from the I2C bus thread whenever a changed frame was sent
+    std::function<void()> onSent;
+
   private:
 
     static const uint16_t ASCIILookup[];
@@ -34,10 +44,41 @@ class SegmentDisplay {
     void write(std::string const &string);
     void writeRaw(uint8_t index, uint16_t bitmask);
     void writeAscii(uint8_t index, uint8_t aChar, bool dot);
+
+    // Sends the buffer, unless the display already shows exactly that
     void commit();
 
-    uint16_t m_displayBuffer[4] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+    uint16_t m_displayBuffer[NumDigits] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+    uint16_t m_shownBuffer[NumDigits] = { 0x0000, 0x0000, 0x0000, 0x0000 };
+    bool m_shownValid = false;
     std::unique_ptr<GPIO::I2CDevice> m_i2cDevice;
 };
 
+// Scrolling text for the display. The message is rendered to glyphs once,
+// scrolling only moves a window over them, so it never allocates.
+class Marquee {
+
+  public:
+
+    static const int MaxGlyphs = 48;
+
+    Marquee();
+
+    // Render a message, dots merge into the glyph before them.
+    // Longer messages are cut off.
+    void Set(const std::string &message);
+
+    // Move the window one glyph along, back to the start at the end
+    void Advance();
+
+    // Glyphs currently in the window
+    const uint16_t *GetWindow() const { return &m_glyphs[m_offset]; }
+
+  private:
+
+    uint16_t m_glyphs[MaxGlyphs + SegmentDisplay::NumDigits];
+    int m_length;
+    int m_offset;
+};
+
 }
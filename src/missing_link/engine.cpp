@@ -7,13 +7,48 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <cmath>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
 #include "missing_link/engine.hpp"
 #include "missing_link/output.hpp"
 #include "missing_link/user_interface.hpp"
+#include "missing_link/clock_input.hpp"
+#include "missing_link/i2c_bus.hpp"
 
 #define MIN_TEMPO 20.0
 #define MAX_TEMPO 300.0
 
+// How often the output timing summary is logged
+#define OUTPUT_STATS_INTERVAL std::chrono::seconds(60)
+
+// Settings are saved once they haven't changed for this long, so turning
+// the encoder doesn't write the SD card on every step
+#define SETTINGS_SAVE_DELAY std::chrono::seconds(2)
+
+// MIDI ports are rescanned this long after a sound device comes or goes,
+// by then the sequencer has registered its ports
+#define MIDI_HOTPLUG_DELAY std::chrono::milliseconds(500)
+
+// Failed MIDI ports are retried this often even without hotplug
+#define MIDI_RECOVERY_INTERVAL std::chrono::seconds(5)
+
+// Following an external clock, tempo changes smaller than this don't replan the outputs
+#define EXTERNAL_CLOCK_TEMPO_TOLERANCE 0.05
+
+// ...but are still taken this often while the phase drifts the way they push it
+#define EXTERNAL_CLOCK_TEMPO_TRIM_INTERVAL std::chrono::seconds(2)
+
+// Following an external clock, the Link beat is forced onto it once it is this far off
+#define EXTERNAL_CLOCK_PHASE_TOLERANCE std::chrono::microseconds(500)
+
+// Button actions that start or move the beat land this long after the
+// press, so they keep the same timing however long noticing it took
+#define BUTTON_ACTION_LEAD std::chrono::milliseconds(5)
+
+// ...unless we got to it too late for that, then as soon as possible
+#define BUTTON_ACTION_MIN_LEAD std::chrono::milliseconds(1)
+
 using namespace std;
 using namespace MissingLink;
 
@@ -36,6 +71,7 @@ void Engine::Process::Run() {
 void Engine::Process::Stop() {
   if (m_pThread == nullptr) { return; }
   m_bStopped = true;
+  Notify();
   m_pThread->join();
   m_pThread = nullptr;
 }
@@ -54,52 +90,89 @@ void Engine::Process::sleep() {
 Engine::Engine()
   : m_running(true)
   , m_playState(PlayState::Stopped)
-  , m_wifiStatus(WifiState::NO_WIFI_FOUND)
   , m_pWifiStatusFile(unique_ptr<WifiStatus>(new WifiStatus()))
   , m_settings(Settings::Load())
   , m_inputMode(InputMode::BPM)
-  , m_link(m_settings.load().tempo)
+  , m_pReactor(unique_ptr<Reactor>(new Reactor()))
+  , m_link(m_settings.Load().tempo)
   , m_pView(shared_ptr<MainView>(new MainView()))
   , m_pTapTempo(unique_ptr<TapTempo>(new TapTempo()))
-  , m_pMidiOut(std::shared_ptr<MidiOut>(new MidiOut()))
+  , m_pOutputStats(shared_ptr<OutputStats>(new OutputStats()))
+  , m_pInputStats(shared_ptr<InputStats>(new InputStats([this]() { return GetHostTime(); })))
+  , m_pMidiOut(std::shared_ptr<MidiOut>(new MidiOut(m_pOutputStats, [this]() { return GetHostTime(); }, m_settings.Load().midi_sequencer)))
+  , m_pExpander(shared_ptr<IOExpander>(new IOExpander()))
   , m_QueueStartTransport(false)
   , m_currIpAddr("0.0.0.0")
   , m_currIpAddrViewSegment(0)
+  , m_scheduleGeneration(0)
+  , m_pUserInput(unique_ptr<UserInput>(new UserInput(*m_pReactor, [this]() { return GetHostTime(); }, m_pInputStats, m_pExpander)))
+  , m_midiRescanTimer(-1)
+  , m_saveTimer(-1)
+  , m_savedGeneration(0)
+  , m_savingGeneration(0)
+  , m_lastTempoTrim(0)
+  , m_pMidiIn(unique_ptr<MidiClockIn>(new MidiClockIn([this]() { return GetHostTime(); })))
 {
-  Settings settings = m_settings.load();
+  Settings settings = m_settings.Load();
 
-  SysInfo sysInfo;
+  m_savedGeneration = m_settings.GetGeneration();
+  m_settings.onChanged = [this]() {
+    // Every change pushes the save back again
+    m_pReactor->Post([this]() { m_pReactor->SetTimer(m_saveTimer, SETTINGS_SAVE_DELAY); });
+  };
 
   m_link.enable(true);
 
   m_link.enableStartStopSync(settings.start_stop_sync);
 
-  auto outputProcess = unique_ptr<OutputProcess>(new OutputProcess(*this));
+  auto edgeQueue = shared_ptr<EdgeQueue>(new EdgeQueue());
+
+  auto outputProcess = unique_ptr<OutputProcess>(new OutputProcess(*this, edgeQueue, m_pOutputStats, m_pExpander));
+  auto plannerProcess = unique_ptr<EdgePlannerProcess>(new EdgePlannerProcess(*this, edgeQueue));
+  OutputProcess *pOutputProcess = outputProcess.get();
+  plannerProcess->onEdgesPlanned = [pOutputProcess]() { pOutputProcess->Notify(); };
   m_processes.push_back(std::move(outputProcess));
+  m_processes.push_back(std::move(plannerProcess));
 
   auto viewProcess = unique_ptr<ViewUpdateProcess>(new ViewUpdateProcess(*this, m_pView));
   m_processes.push_back(std::move(viewProcess));
 
-  auto uiProcess = unique_ptr<UserInputProcess>(new UserInputProcess(*this));
-  uiProcess->onPlayStop = bind(&Engine::playStop, this);
-  uiProcess->onEncoderAndTap = bind(&Engine::zeroTimeline, this);
-  uiProcess->onEncoderAndPlay = bind(&Engine::queueStartTransportAtLoopStart, this);
-  uiProcess->onTapTempo = bind(&TapTempo::Tap, m_pTapTempo.get());
-  uiProcess->onEncoderRotate = bind(&Engine::routeEncoderAdjust, this, placeholders::_1);
-  uiProcess->onEncoderPress = bind(&Engine::toggleMode, this);
-  m_processes.push_back(std::move(uiProcess));
+  auto pInputStats = m_pInputStats;
+  m_pView->OnDisplaySent([pInputStats]() { pInputStats->DisplaySent(); });
+
+  m_pUserInput->onPlayStop = bind(&Engine::playStop, this, placeholders::_1);
+  m_pUserInput->onEncoderAndTap = bind(&Engine::zeroTimeline, this, placeholders::_1);
+  m_pUserInput->onEncoderAndPlay = bind(&Engine::queueStartTransportAtLoopStart, this);
+  m_pUserInput->onTapTempo = bind(&Engine::tapTempo, this, placeholders::_1);
+  m_pUserInput->onEncoderRotate = bind(&Engine::routeEncoderAdjust, this, placeholders::_1);
+  m_pUserInput->onEncoderPress = bind(&Engine::toggleMode, this);
+
+  auto clockInputProcess = unique_ptr<ClockInputProcess>(new ClockInputProcess(*this));
+  clockInputProcess->onClock = bind(&Engine::followExternalClock, this, placeholders::_1, ClockSource::Analog);
+  m_processes.push_back(std::move(clockInputProcess));
 
   m_pTapTempo->onNewTempo = bind(&Engine::setTempo, this, placeholders::_1);
+  m_pTapTempo->onBeat = bind(&Engine::alignBeat, this, placeholders::_1);
+
+  m_pMidiIn->onClock = bind(&Engine::followExternalClock, this, placeholders::_1, ClockSource::Midi);
+  // Transport changes are handled on the reactor like button presses
+  m_pMidiIn->onStart = [this]() { m_pReactor->Post(bind(&Engine::midiStart, this)); };
+  m_pMidiIn->onStop = [this]() { m_pReactor->Post(bind(&Engine::midiStop, this)); };
 
   m_link.setNumPeersCallback([this](std::size_t numPeers) {
-    std::string message = "    " + std::to_string(numPeers) + " LINKS    ";
-    m_pView->WriteDisplayTemporarily(message, 2000, true);
+    m_pReactor->Post([this, numPeers]() {
+      std::string message = "    " + std::to_string(numPeers) + " LINKS    ";
+      m_pView->WriteDisplayTemporarily(message, 2000, true);
+    });
   });
 
   m_link.setTempoCallback([this](const double tempo) {
-    if (m_inputMode == InputMode::BPM) {
-      displayTempo(tempo, false);
-    }
+    InvalidateSchedule();
+    m_pReactor->Post([this, tempo]() {
+      if (m_inputMode == InputMode::BPM) {
+        displayTempo(tempo, false);
+      }
+    });
   });
 
   m_link.setStartStopCallback([this](const bool isPlaying) {
@@ -112,27 +185,38 @@ Engine::Engine()
       m_playState = PlayState::Stopped;
       //message = "    SYNC STOP    "; //but these display even if local play button is hit
     }
+    InvalidateSchedule();
     //m_pView->WriteDisplayTemporarily(message, 2000, true);
   });
 
 }
 
+Engine::~Engine() {
+  // SysInfo goes first and closes its socket, the reactor must not touch it
+  m_pReactor->Unwatch(sysInfo.GetFd());
+}
+
 void Engine::Run() {
-  WifiState prevWifiStatus;
   displayTempo(getCurrentTempo(), true);
 
   for (auto &process : m_processes) {
     process->Run();
   }
 
-  while (isRunning()) {
-    Settings settings = m_settings.load();
+  startHousekeeping();
+  m_pReactor->Run();
+  m_running = false;
+
+  // Don't lose a change still waiting for its save. The reactor is gone,
+  // so this one is written right here.
+  if (m_pSaveThread) {
+    m_pSaveThread->join();
+    m_pSaveThread.reset();
+    m_savedGeneration = m_savingGeneration;
+  }
+  Settings settings;
+  if (m_settings.Load(settings) != m_savedGeneration) {
     Settings::Save(settings);
-    prevWifiStatus = m_wifiStatus;
-    m_wifiStatus = m_pWifiStatusFile->ReadStatus();
-    if (prevWifiStatus != m_wifiStatus) displayTempWifiStatus(m_wifiStatus);
-    m_pMidiOut->CheckPorts();
-    this_thread::sleep_for(chrono::seconds(1));
   }
 
   for (auto &process : m_processes) {
@@ -140,17 +224,90 @@ void Engine::Run() {
   }
 }
 
+void Engine::Stop() {
+  m_running = false;
+  m_pReactor->Stop();
+}
+
+void Engine::saveSettings() {
+  // One save at a time, finishSave() comes back for changes made meanwhile
+  if (m_pSaveThread) {
+    return;
+  }
+  Settings settings;
+  const unsigned int generation = m_settings.Load(settings);
+  if (generation == m_savedGeneration) {
+    return;
+  }
+  // Writing and syncing the files can take long enough to be felt on the
+  // buttons, so the reactor only hears back once it is done
+  m_savingGeneration = generation;
+  m_pSaveThread = unique_ptr<thread>(new thread([this, settings]() {
+    Settings::Save(settings);
+    m_pReactor->Post(bind(&Engine::finishSave, this));
+  }));
+}
+
+void Engine::finishSave() {
+  if (!m_pSaveThread) {
+    return;
+  }
+  m_pSaveThread->join();
+  m_pSaveThread.reset();
+  m_savedGeneration = m_savingGeneration;
+  if (m_settings.GetGeneration() != m_savedGeneration) {
+    m_pReactor->SetTimer(m_saveTimer, SETTINGS_SAVE_DELAY);
+  }
+}
+
+void Engine::startHousekeeping() {
+  m_saveTimer = m_pReactor->AddTimer(bind(&Engine::saveSettings, this));
+
+  m_pWifiStatusFile->Watch(*m_pReactor, bind(&Engine::displayTempWifiStatus, this, placeholders::_1));
+
+  // Follow address changes, so the IP shows up as soon as DHCP assigns it
+  m_pReactor->Watch(sysInfo.GetFd(), EPOLLIN, [this](uint32_t) {
+    if (sysInfo.ProcessEvents() && m_inputMode == InputMode::DisplayIP) {
+      m_currIpAddr = sysInfo.GetIP();
+      displayIpAddrSegment(m_currIpAddrViewSegment, true);
+    }
+  });
+
+  m_pReactor->AddPeriodic(OUTPUT_STATS_INTERVAL, [this]() {
+    m_pOutputStats->Print(std::cout);
+    m_pOutputStats->Reset();
+    m_pInputStats->Print(std::cout);
+    m_pInputStats->Reset();
+    auto pBus = I2CBus::Get(ML_DEFAULT_I2C_BUS);
+    pBus->PrintStats(std::cout);
+    pBus->ResetStats();
+  });
+
+  // Rescan MIDI ports when sound devices come and go, and now and then
+  // to reopen ports that failed
+  auto checkMidiPorts = [this]() {
+    m_pMidiOut->CheckPorts();
+    m_pMidiIn->CheckPorts();
+  };
+  checkMidiPorts();
+  m_midiRescanTimer = m_pReactor->AddTimer(checkMidiPorts);
+  m_pReactor->WatchPath("/dev/snd", IN_CREATE | IN_DELETE, [this](const std::string&, uint32_t) {
+    m_pReactor->SetTimer(m_midiRescanTimer, MIDI_HOTPLUG_DELAY);
+  });
+  m_pReactor->AddPeriodic(MIDI_RECOVERY_INTERVAL, checkMidiPorts);
+}
+
 const double Engine::GetNormalizedPhase() const {
-  const auto now = m_link.clock().micros() + std::chrono::milliseconds(getCurrentDelayCompensation());
-  const auto currentSettings = m_settings.load();
+  const auto currentSettings = m_settings.Load();
+  const auto now = m_link.clock().micros() + std::chrono::milliseconds(currentSettings.delay_compensation);
   const auto timeline = m_link.captureAppSessionState();
   const double phase = timeline.phaseAtTime(now, currentSettings.quantum);
   return min(1.0, max(0.0, phase / (double)currentSettings.quantum));
 }
 
 const double Engine::GetBeatPhase() const {
-  const auto now = m_link.clock().micros() + std::chrono::milliseconds(getCurrentDelayCompensation());
-  const auto currentSettings = m_settings.load();
+  const auto currentSettings = m_settings.Load();
+  const auto now = m_link.clock().micros() + std::chrono::milliseconds(currentSettings.delay_compensation);
   const auto timeline = m_link.captureAppSessionState();
   const double beat = timeline.beatAtTime(now, currentSettings.quantum);
   float wholeNum, beatPhase; //whole num needed for modf, but not used otherwise
@@ -167,42 +324,13 @@ const int Engine::GetNumberOfPeers() const {
   return m_link.numPeers();
 }
 
-const Engine::OutputModel Engine::GetOutputModel(std::chrono::microseconds last) const {
-  OutputModel output;
-
-  const auto now = m_link.clock().micros() - std::chrono::milliseconds(getCurrentDelayCompensation());
-  output.now = now;
-
-  auto timeline = m_link.captureAudioSessionState();
-  output.tempo = timeline.tempo();
-
-  if (last == std::chrono::microseconds(0)) {
-    output.clockTriggered = false;
-    output.resetTriggered = false;
-    output.midiClockTriggered = false;
-    return output;
-  }
-
-  const auto currentSettings = m_settings.load();
-  const double beats = timeline.beatAtTime(now, currentSettings.quantum);
-  const double lastBeats = timeline.beatAtTime(last, currentSettings.quantum);
-
-  const int edgesPerBeat = currentSettings.getPPQN() * 2;
-  const int midiEdgesPerBeat = 24 * 2;
-  const int edgesPerLoop = edgesPerBeat * currentSettings.quantum;
-
-  const int edge = (int)floor(beats * (double)edgesPerBeat);
-  const int lastEdge = (int)floor(lastBeats * (double)edgesPerBeat);
-
-  const int midiEdge = (int)floor(beats * (double)midiEdgesPerBeat);
-  const int midiLastEdge = (int)floor(lastBeats * (double)midiEdgesPerBeat);
-
-  output.clockTriggered = (edge % 2 == 0) && (edge != lastEdge);
-  output.resetTriggered = output.clockTriggered && (edge % edgesPerLoop == 0);
-
-  output.midiClockTriggered = (midiEdge % 2 == 0) && (midiEdge != midiLastEdge);
+ableton::Link::SessionState Engine::CaptureAudioSessionState() const {
+  return m_link.captureAudioSessionState();
+}
 
-  return output;
+void Engine::InvalidateSchedule() {
+  m_scheduleGeneration++;
+  notifyProcesses();
 }
 
 bool Engine::GetQueuedStartTransport() {
@@ -219,17 +347,17 @@ void Engine::SetPlayState(PlayState state) {
 }
 
 int Engine::getWifiStatus() {
-  return m_wifiStatus;
+  return m_pWifiStatusFile->GetStatus();
 }
 
 int Engine::getResetMode() {
   return getCurrentResetMode();
 }
 
-void Engine::playStop() {
+void Engine::playStop(std::chrono::microseconds time) {
   switch (m_playState) {
     case PlayState::Stopped:
-      startTimeline();
+      startTimeline(time);
       m_playState = PlayState::Cued;
       break;
     case PlayState::Playing:
@@ -243,6 +371,24 @@ void Engine::playStop() {
     default:
       break;
   }
+  InvalidateSchedule();
+}
+
+void Engine::ApplySettings(const Settings &settings) {
+  auto now = m_link.clock().micros();
+  auto timeline = m_link.captureAppSessionState();
+  timeline.setTempo(std::max(MIN_TEMPO, std::min(MAX_TEMPO, settings.tempo)), now);
+  m_link.commitAppSessionState(timeline);
+  m_link.enableStartStopSync(settings.start_stop_sync);
+
+  m_settings.Store(settings);
+  InvalidateSchedule();
+}
+
+void Engine::Play() {
+  if (m_playState == PlayState::Stopped) {
+    playStop(GetHostTime());
+  }
 }
 
 void Engine::queueStartTransportAtLoopStart() {
@@ -252,34 +398,62 @@ void Engine::queueStartTransportAtLoopStart() {
   }
 }
 
-void Engine::zeroTimeline() {
-  const auto now = m_link.clock().micros() + std::chrono::milliseconds(-1 * getCurrentDelayCompensation());
+void Engine::zeroTimeline(std::chrono::microseconds time) {
+  const auto currentSettings = m_settings.Load();
+  const auto beatTime = buttonActionTime(time) + std::chrono::milliseconds(-1 * currentSettings.delay_compensation);
   auto timeline = m_link.captureAppSessionState();
-  const auto currentSettings = m_settings.load();
   m_pView->WriteDisplayTemporarily("    ZERO TIMELINE    ", 2500, true);
-  timeline.forceBeatAtTime(0, now + std::chrono::milliseconds(5), currentSettings.quantum);
+  timeline.forceBeatAtTime(0, beatTime, currentSettings.quantum);
   m_link.commitAppSessionState(timeline);
   m_QueueStartTransport = true;
+  InvalidateSchedule();
+}
+
+void Engine::tapTempo(std::chrono::microseconds time) {
+  const auto settings = m_settings.Load();
+  TapTempo::Options options;
+  options.window = settings.tap_window;
+  options.wholeBpm = settings.tap_whole_bpm;
+  m_pTapTempo->SetOptions(options);
+  m_pTapTempo->Tap(time);
+}
+
+void Engine::alignBeat(std::chrono::microseconds time) {
+  const auto settings = m_settings.Load();
+  if (!settings.tap_align_beat) { return; }
+
+  // The taps follow what the outputs play, delay compensation included
+  const auto beatTime = time + std::chrono::milliseconds(-1 * settings.delay_compensation);
+  auto timeline = m_link.captureAppSessionState();
+  const double beat = std::round(timeline.beatAtTime(beatTime, settings.quantum));
+  timeline.forceBeatAtTime(beat, beatTime, settings.quantum);
+  m_link.commitAppSessionState(timeline);
+  InvalidateSchedule();
 }
 
 void Engine::toggleMode() {
   auto now = Clock::now();
   // Only switch to next mode if toggle pressed twice within 1.5 seconds
   if (now - m_lastToggle < std::chrono::milliseconds(1500)) {
-    m_inputMode = static_cast<InputMode>((static_cast<int>(m_inputMode.load()) + 1) % 7);
+    m_inputMode = static_cast<InputMode>((static_cast<int>(m_inputMode.load()) + 1) % 8);
   }
   m_lastToggle = Clock::now();
   displayCurrentMode();
 }
 
-void Engine::startTimeline() {
+std::chrono::microseconds Engine::buttonActionTime(std::chrono::microseconds pressTime) const {
+  return std::max<std::chrono::microseconds>(pressTime + BUTTON_ACTION_LEAD, GetHostTime() + BUTTON_ACTION_MIN_LEAD);
+}
+
+void Engine::startTimeline(std::chrono::microseconds time) {
   auto timeline = m_link.captureAppSessionState();
   auto now = m_link.clock().micros();
   if (m_link.numPeers() == 0){
-    timeline.forceBeatAtTime(0, now + std::chrono::milliseconds(1), m_settings.load().quantum);
-    timeline.setIsPlaying(true, now + std::chrono::milliseconds(1));
+    const auto startTime = buttonActionTime(time);
+    timeline.forceBeatAtTime(0, startTime, m_settings.Load().quantum);
+    timeline.setIsPlaying(true, startTime);
   } else {
-    timeline.setIsPlayingAndRequestBeatAtTime(true, now, 0, m_settings.load().quantum);
+    timeline.setIsPlayingAndRequestBeatAtTime(true, now, 0, m_settings.Load().quantum);
   }
   m_link.commitAppSessionState(timeline);
 }
@@ -287,7 +461,7 @@ void Engine::startTimeline() {
 void Engine::stopTimeline() {
   auto timeline = m_link.captureAppSessionState();
   auto now = m_link.clock().micros();
-  timeline.setIsPlayingAndRequestBeatAtTime(false, now, 0, m_settings.load().quantum);
+  timeline.setIsPlayingAndRequestBeatAtTime(false, now, 0, m_settings.Load().quantum);
   m_link.commitAppSessionState(timeline);
 }
 
@@ -300,15 +474,76 @@ void Engine::setTempo(double tempo) {
   timeline.setTempo(tempo, now);
   m_link.commitAppSessionState(timeline);
 
-  auto settings = m_settings.load();
-  settings.tempo = tempo;
-  m_settings = settings;
+  m_settings.Update([tempo](Settings &settings) {
+    settings.tempo = tempo;
+  });
 
   // switch back to tempo mode
   m_inputMode = InputMode::BPM;
+  InvalidateSchedule();
   displayTempo(tempo, true);
 }
 
+void Engine::notifyProcesses() {
+  for (auto &process : m_processes) {
+    process->Notify();
+  }
+}
+
+void Engine::followExternalClock(const ExternalClock &clock, ClockSource source) {
+  const auto settings = m_settings.Load();
+  if (settings.clock_source != source) { return; }
+
+  const double tempo = std::max(MIN_TEMPO, std::min(MAX_TEMPO, clock.tempo));
+  auto timeline = m_link.captureAppSessionState();
+
+  // Keep the Link beat on the song position if there is one, otherwise
+  // just keep the clock ticks on the nearest tick of the Link beat grid
+  const auto targetBeat = [&clock](double beat) {
+    return clock.positioned ? clock.beat : std::round(beat * clock.ticksPerBeat) / clock.ticksPerBeat;
+  };
+  double beat = timeline.beatAtTime(clock.time, settings.quantum);
+
+  // Committing a tempo fires the Link tempo callback, and with it a replan
+  // here and on every peer. Small differences are only taken now and then,
+  // while the Link beat keeps drifting off the clock the way they push it,
+  // so the phase seldom has to be forced.
+  const double tempoError = tempo - timeline.tempo();
+  const bool drifting = tempoError * (beat - targetBeat(beat)) < 0.0;
+  bool retime = std::fabs(tempoError) > EXTERNAL_CLOCK_TEMPO_TOLERANCE;
+  if (retime || (drifting && clock.time - m_lastTempoTrim >= EXTERNAL_CLOCK_TEMPO_TRIM_INTERVAL)) {
+    timeline.setTempo(tempo, clock.time);
+    beat = timeline.beatAtTime(clock.time, settings.quantum);
+    m_lastTempoTrim = clock.time;
+    retime = true;
+  }
+
+  const double target = targetBeat(beat);
+  const auto error = std::chrono::microseconds((long long)(std::fabs(beat - target) * 60.0e6 / tempo));
+  if (error > EXTERNAL_CLOCK_PHASE_TOLERANCE) {
+    timeline.forceBeatAtTime(target, clock.time, settings.quantum);
+    retime = true;
+  }
+
+  m_link.commitAppSessionState(timeline);
+  if (retime) {
+    InvalidateSchedule();
+  }
+}
+
+void Engine::midiStart() {
+  if (getCurrentClockSource() == ClockSource::Midi) {
+    Play();
+  }
+}
+
+void Engine::midiStop() {
+  if (getCurrentClockSource() == ClockSource::Midi && m_playState != PlayState::Stopped) {
+    SetPlayState(PlayState::Stopped);
+    InvalidateSchedule();
+  }
+}
+
 void Engine::routeEncoderAdjust(float amount) {
   switch (m_inputMode) {
     case InputMode::BPM:
@@ -329,6 +564,9 @@ void Engine::routeEncoderAdjust(float amount) {
     case InputMode::StartStopSync:
       StartStopSyncAdjust(amount);
       break;
+    case InputMode::ClockSource:
+      clockSourceAdjust(amount > 0.0 ? 1 : -1);
+      break;
     case InputMode::DisplayIP:
       ipAddressAdjust(amount > 0.0 ? 1 : -1);
     default:
@@ -341,38 +579,37 @@ void Engine::tempoAdjust(float amount) {
 }
 
 void Engine::loopAdjust(int amount) {
-  auto settings = m_settings.load();
-  int quantum = std::max(1, settings.quantum + amount);
-  settings.quantum = quantum;
-  m_settings = settings;
-  displayQuantum(quantum, true);
+  auto settings = m_settings.Update([amount](Settings &settings) {
+    settings.quantum = std::max(1, settings.quantum + amount);
+  });
+  InvalidateSchedule();
+  displayQuantum(settings.quantum, true);
 }
 
 void Engine::delayCompensationAdjust(int amount) {
-  auto settings = m_settings.load();
-  int delay = settings.delay_compensation + amount;
-  settings.delay_compensation = delay;
-  m_settings = settings;
-  displayDelayCompensation(delay, true);
+  auto settings = m_settings.Update([amount](Settings &settings) {
+    settings.delay_compensation += amount;
+  });
+  InvalidateSchedule();
+  displayDelayCompensation(settings.delay_compensation, true);
 }
 
 void Engine::ppqnAdjust(int amount) {
   int max_index = Settings::ppqn_options.size() - 1;
-  auto settings = m_settings.load();
-  int index = std::min(max_index, std::max(0, settings.ppqn_index + amount));
-  settings.ppqn_index = index;
-  m_settings = settings;
-  int ppqn = Settings::ppqn_options[index];
-  displayPPQN(ppqn, true);
+  auto settings = m_settings.Update([amount, max_index](Settings &settings) {
+    settings.ppqn_index = std::min(max_index, std::max(0, settings.ppqn_index + amount));
+  });
+  InvalidateSchedule();
+  displayPPQN(settings.getPPQN(), true);
 }
 
 void Engine::resetModeAdjust(int amount) {
   int num_options = 3;
-  auto settings = m_settings.load();
-  int mode = std::min(num_options - 1, std::max(0, settings.reset_mode + amount));
-  settings.reset_mode = mode;
-  m_settings = settings;
-  displayResetMode(mode, true);
+  auto settings = m_settings.Update([amount, num_options](Settings &settings) {
+    settings.reset_mode = std::min(num_options - 1, std::max(0, settings.reset_mode + amount));
+  });
+  InvalidateSchedule();
+  displayResetMode(settings.reset_mode, true);
 }
 
 void Engine::ipAddressAdjust(int amount) {
@@ -393,15 +630,23 @@ std::shared_ptr<MissingLink::MainView> Engine::GetMainView() {
 
 void Engine::StartStopSyncAdjust(float amount) {
   //clockwise set value to true, counterclock set value to false
-  auto settings = m_settings.load();
-  bool ss_sync = settings.start_stop_sync;
-  ss_sync = amount > 0 ? true : false;
-  settings.start_stop_sync = ss_sync;
-  m_settings = settings;
+  bool ss_sync = amount > 0 ? true : false;
+  m_settings.Update([ss_sync](Settings &settings) {
+    settings.start_stop_sync = ss_sync;
+  });
   m_link.enableStartStopSync(ss_sync);
   displayStartStopSync(ss_sync, true);
 }
 
+void Engine::clockSourceAdjust(int amount) {
+  int num_options = 3;
+  auto settings = m_settings.Update([amount, num_options](Settings &settings) {
+    int source = static_cast<int>(settings.clock_source);
+    settings.clock_source = static_cast<ClockSource>(std::min(num_options - 1, std::max(0, source + amount)));
+  });
+  displayClockSource(settings.clock_source, true);
+}
+
 void Engine::displayCurrentMode() {
   const int holdTime = 1500;
   switch (m_inputMode) {
@@ -435,6 +680,11 @@ void Engine::displayCurrentMode() {
       displayStartStopSync(getCurrentStartStopSync(), false);
       break;
     }
+    case InputMode::ClockSource: {
+      m_pView->WriteDisplayTemporarily("    CLOCK SOURCE    ", 2400, true);
+      displayClockSource(getCurrentClockSource(), false);
+      break;
+    }
     case InputMode::DisplayIP: {
       m_currIpAddr = sysInfo.GetIP();
       m_pView->WriteDisplayTemporarily("    IP ADDRESS    ", 2200, true);
@@ -513,6 +763,23 @@ void Engine::displayStartStopSync(bool sync, bool force) {
   }
 }
 
+void Engine::displayClockSource(ClockSource source, bool force) {
+  switch (source) {
+    case ClockSource::Link:
+      m_pView->WriteDisplay("LINK", force);
+      break;
+    case ClockSource::Midi:
+      m_pView->WriteDisplay("MIDI", force);
+      break;
+    case ClockSource::Analog:
+      m_pView->WriteDisplay("CV", force);
+      break;
+    default:
+      m_pView->WriteDisplay("WHAT", force);
+      break;
+  }
+}
+
 void Engine::displayIpAddrSegment(int pos, bool force) {
   std::string s = m_currIpAddr;
   std::string results[4];
@@ -533,26 +800,31 @@ double Engine::getCurrentTempo() const {
 }
 
 int Engine::getCurrentQuantum() const {
-  auto settings = m_settings.load();
+  auto settings = m_settings.Load();
   return settings.quantum;
 }
 
 int Engine::getCurrentPPQN() const {
-  auto settings = m_settings.load();
+  auto settings = m_settings.Load();
   return Settings::ppqn_options[settings.ppqn_index];
 }
 
 int Engine::getCurrentResetMode() const {
-  auto settings = m_settings.load();
+  auto settings = m_settings.Load();
   return settings.reset_mode;
 }
 
 int Engine::getCurrentDelayCompensation() const {
-  auto settings = m_settings.load();
+  auto settings = m_settings.Load();
   return settings.delay_compensation;
 }
 
 int Engine::getCurrentStartStopSync() const {
-  auto settings = m_settings.load();
+  auto settings = m_settings.Load();
   return settings.start_stop_sync;
 }
+
+ClockSource Engine::getCurrentClockSource() const {
+  auto settings = m_settings.Load();
+  return settings.clock_source;
+}
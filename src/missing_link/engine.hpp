@@ -14,10 +14,17 @@
 #include "missing_link/types.hpp"
 #include "missing_link/tap_tempo.hpp"
 #include "missing_link/settings.hpp"
+#include "missing_link/settings_store.hpp"
 #include "missing_link/view.hpp"
 #include "missing_link/wifi_status.hpp"
 #include "missing_link/midi_out.hpp"
+#include "missing_link/midi_in.hpp"
 #include "missing_link/system_info.hpp"
+#include "missing_link/output_stats.hpp"
+#include "missing_link/input_stats.hpp"
+#include "missing_link/io_expander.hpp"
+#include "missing_link/reactor.hpp"
+#include "missing_link/user_interface.hpp"
 
 namespace MissingLink {
 
@@ -39,18 +46,10 @@ namespace MissingLink {
         ResetMode,
         DelayCompensation,
         StartStopSync,
+        ClockSource,
         DisplayIP
       };
 
-      /// Model for engine output processes
-      struct OutputModel {
-        std::chrono::microseconds now;
-        double tempo;
-        bool clockTriggered;
-        bool resetTriggered;
-        bool midiClockTriggered;
-      };
-
       class Process {
 
         public:
@@ -61,6 +60,9 @@ namespace MissingLink {
           virtual void Run();
           void Stop();
 
+          // Wake the process early, e.g. after a play state or settings change
+          virtual void Notify() {}
+
           bool IsRunning() const { return !m_bStopped; }
 
         protected:
@@ -70,23 +72,38 @@ namespace MissingLink {
 
           virtual void run();
           virtual void process() = 0;
+          void sleep();
 
         private:
 
-          void sleep();
           std::chrono::microseconds m_sleepTime;
           std::atomic<bool> m_bStopped;
       };
 
       Engine();
+      virtual ~Engine();
 
+      // Runs the housekeeping reactor on the calling thread until Stop()
       void Run();
 
+      // Makes Run() return. Safe from any thread.
+      void Stop();
+
       const bool isRunning() const { return m_running; }
       const double GetNormalizedPhase() const;
       const double GetBeatPhase() const;
       const int GetNumberOfPeers() const;
-      const OutputModel GetOutputModel(std::chrono::microseconds last) const;
+
+      // Current Link host time
+      std::chrono::microseconds GetHostTime() const { return m_link.clock().micros(); }
+
+      // Realtime-safe timeline capture. Only the edge planner thread may call this.
+      ableton::Link::SessionState CaptureAudioSessionState() const;
+
+      // Bumped whenever the timeline, tempo or output settings change,
+      // so any edges planned against the previous state get thrown away
+      unsigned int GetScheduleGeneration() const { return m_scheduleGeneration.load(); }
+      void InvalidateSchedule();
 
       PlayState GetPlayState() const { return m_playState.load(); }
       void SetPlayState(PlayState state);
@@ -95,38 +112,83 @@ namespace MissingLink {
 
       int getWifiStatus();
       int getResetMode();
+      Settings GetSettings() const { return m_settings.Load(); }
+
+      // Snapshot of the settings, returns the generation it belongs to
+      unsigned int GetSettings(Settings &settings) const { return m_settings.Load(settings); }
+
+      // Changes every time the settings change
+      unsigned int GetSettingsGeneration() const { return m_settings.GetGeneration(); }
 
       std::shared_ptr<MidiOut> GetMidiOut();
       std::shared_ptr<MainView> GetMainView();
+      std::shared_ptr<OutputStats> GetOutputStats() { return m_pOutputStats; }
+
+      // Replace all settings at once and retime the outputs, e.g. from the benchmark
+      void ApplySettings(const Settings &settings);
+
+      // Start playing from the top of the loop, as the play button would when stopped
+      void Play();
 
     private:
 
       std::atomic<bool> m_running;
       std::atomic<PlayState> m_playState;
-      std::atomic<WifiState> m_wifiStatus;
       std::shared_ptr<WifiStatus> m_pWifiStatusFile;
-      std::atomic<Settings> m_settings;
+      SettingsStore m_settings;
       std::atomic<InputMode> m_inputMode;
 
+      // All non-realtime work runs on this, on the thread that called Run().
+      // Outlives Link, whose callbacks post to it.
+      std::unique_ptr<Reactor> m_pReactor;
+
       ableton::Link m_link;
 
       std::shared_ptr<MainView> m_pView;
       std::unique_ptr<TapTempo> m_pTapTempo;
+      std::shared_ptr<OutputStats> m_pOutputStats;
+      std::shared_ptr<InputStats> m_pInputStats;
       std::shared_ptr<MidiOut> m_pMidiOut;
+      // Buttons and encoder on its inputs, clock channels 1-3 on its outputs
+      std::shared_ptr<IOExpander> m_pExpander;
       std::atomic<bool> m_QueueStartTransport;
       std::string m_currIpAddr;
       std::atomic<int> m_currIpAddrViewSegment;
+      std::atomic<unsigned int> m_scheduleGeneration;
       std::vector<std::unique_ptr<Process>> m_processes;
 
+      std::unique_ptr<UserInput> m_pUserInput;
+      int m_midiRescanTimer;
+      int m_saveTimer;
+      unsigned int m_savedGeneration;
+      unsigned int m_savingGeneration;
+      std::unique_ptr<std::thread> m_pSaveThread;  // save in progress, joined on the reactor
+      std::chrono::microseconds m_lastTempoTrim;  // clock time of the last small tempo change taken
+
+      // Declared last so its input threads stop before anything they call into goes away
+      std::unique_ptr<MidiClockIn> m_pMidiIn;
+
       SysInfo sysInfo;
 
-      void playStop();
+      // time is the host time of the button press, or now
+      void playStop(std::chrono::microseconds time);
       void queueStartTransportAtLoopStart();
-      void zeroTimeline();
+      void zeroTimeline(std::chrono::microseconds time);
+      void tapTempo(std::chrono::microseconds time);
+      // Moves the beat grid so the nearest beat lands on time
+      void alignBeat(std::chrono::microseconds time);
       void toggleMode();
-      void startTimeline();
+      void startTimeline(std::chrono::microseconds time);
+      std::chrono::microseconds buttonActionTime(std::chrono::microseconds pressTime) const;
       void stopTimeline();
       void setTempo(double tempo);
+      void notifyProcesses();
+      void startHousekeeping();
+      void saveSettings();
+      void finishSave();
+      void followExternalClock(const ExternalClock &clock, ClockSource source);
+      void midiStart();
+      void midiStop();
 
       void routeEncoderAdjust(float amount);
       void tempoAdjust(float amount);
@@ -135,6 +197,7 @@ namespace MissingLink {
       void resetModeAdjust(int amount);
       void delayCompensationAdjust(int amount);
       void StartStopSyncAdjust(float amount);
+      void clockSourceAdjust(int amount);
       void ipAddressAdjust(int amount);
 
       void displayCurrentMode();
@@ -145,6 +208,7 @@ namespace MissingLink {
       void displayResetMode(int mode, bool force);
       void displayDelayCompensation(int delay, bool force);
       void displayStartStopSync(bool sync, bool force);
+      void displayClockSource(ClockSource source, bool force);
       void displayIpAddrSegment(int pos, bool force);
 
       double getCurrentTempo() const;
@@ -153,6 +217,7 @@ namespace MissingLink {
       int getCurrentResetMode() const;
       int getCurrentDelayCompensation() const;
       int getCurrentStartStopSync() const;
+      ClockSource getCurrentClockSource() const;
 
       TimePoint m_lastToggle;
   };
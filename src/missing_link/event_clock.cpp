@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <time.h>
+#include "missing_link/event_clock.hpp"
+
+using namespace MissingLink;
+
+namespace MissingLink {
+
+  // How often the clocks are compared
+  static const std::chrono::seconds ClockSyncInterval(1);
+
+  // Offset changes bigger than this are taken at once instead of smoothed
+  static const std::chrono::nanoseconds MaxClockOffsetStep(1000000);
+
+  static std::chrono::nanoseconds readClock(int clockId) {
+    timespec ts;
+    ::clock_gettime(clockId, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+  }
+
+}
+
+ClockOffset::ClockOffset()
+  : m_valid(false)
+  , m_offset(0)
+{}
+
+bool ClockOffset::IsSyncDue() {
+  const auto now = Clock::now();
+  if (m_valid && now - m_lastSync < ClockSyncInterval) {
+    return false;
+  }
+  m_lastSync = now;
+  return true;
+}
+
+void ClockOffset::Sync(std::chrono::nanoseconds reading) {
+  m_lastSync = Clock::now();
+  const auto step = reading - m_offset;
+  if (!m_valid || step > MaxClockOffsetStep || step < -MaxClockOffsetStep) {
+    m_offset = reading;
+    m_valid = true;
+  } else {
+    m_offset += step / 8;
+  }
+}
+
+EventClock::EventClock(HostClock hostClock)
+  : m_hostClock(hostClock)
+  , m_eventClock(-1)
+{}
+
+std::chrono::microseconds EventClock::ToHostTime(std::chrono::nanoseconds eventTime) {
+  if (m_offset.IsSyncDue()) {
+    syncOffset(eventTime);
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(eventTime + m_offset.Get());
+}
+
+void EventClock::syncOffset(std::chrono::nanoseconds eventTime) {
+  if (m_eventClock < 0) {
+    // An event that just happened is close to whichever clock it was
+    // stamped with
+    const auto sinceEvent = readClock(CLOCK_MONOTONIC) - eventTime;
+    m_eventClock = (sinceEvent > std::chrono::seconds(-1) && sinceEvent < std::chrono::seconds(10)) ?
+      CLOCK_MONOTONIC : CLOCK_REALTIME;
+  }
+
+  const auto before = m_hostClock();
+  const auto clockTime = readClock(m_eventClock);
+  const auto after = m_hostClock();
+  m_offset.Sync(std::chrono::duration_cast<std::chrono::nanoseconds>(before + (after - before) / 2) - clockTime);
+}
@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <chrono>
+#include "missing_link/types.hpp"
+#include "missing_link/host_clock.hpp"
+
+namespace MissingLink {
+
+  // Offset between two clocks, from readings taken now and then. Each
+  // reading carries the jitter of the syscalls taking it, so small changes
+  // are smoothed and only the trend, e.g. of NTP slewing one clock against
+  // the other, is followed. Big steps are taken at once. Not thread safe.
+  class ClockOffset {
+
+    public:
+
+      ClockOffset();
+
+      // True when a new reading is due. Restarts the interval, so a reading
+      // that can't be taken isn't retried right away.
+      bool IsSyncDue();
+
+      void Sync(std::chrono::nanoseconds reading);
+
+      bool IsValid() const { return m_valid; }
+      std::chrono::nanoseconds Get() const { return m_offset; }
+
+    private:
+
+      bool m_valid;                       // false until the first reading
+      std::chrono::nanoseconds m_offset;
+      TimePoint m_lastSync;
+  };
+
+  // Converts kernel event timestamps, e.g. of GPIO line events, to host
+  // time. The kernel stamps them with CLOCK_MONOTONIC, or CLOCK_REALTIME
+  // before Linux 5.7, neither of which is the Link clock. The offset is
+  // measured now and then and smoothed, as the clocks drift apart.
+  // Not thread safe, use one per thread.
+  class EventClock {
+
+    public:
+
+      EventClock(HostClock hostClock);
+
+      std::chrono::microseconds ToHostTime(std::chrono::nanoseconds eventTime);
+
+    private:
+
+      void syncOffset(std::chrono::nanoseconds eventTime);
+
+      HostClock m_hostClock;
+      int m_eventClock;                   // clock id the kernel stamps events with
+      ClockOffset m_offset;               // host time minus event clock time
+  };
+
+}
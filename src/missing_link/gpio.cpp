@@ -11,10 +11,10 @@
 #include <unistd.h>
 #include <poll.h>
 #include <sys/ioctl.h>
-#include <linux/i2c.h>
-#include <linux/i2c-dev.h>
+#include <linux/gpio.h>
 
 #include "missing_link/gpio.hpp"
+#include "missing_link/simulator.hpp"
 
 using std::string;
 using namespace MissingLink;
@@ -26,6 +26,7 @@ Pin::Pin(int address, Direction direction)
   : m_address(address)
   , m_direction(direction)
   , m_pinInterfacePath(s_rootInterfacePath + "/gpio" + std::to_string(address))
+  , m_simulated(Hardware::IsSimulated())
   , m_fd(-1)
 {
   open();
@@ -56,6 +57,9 @@ void Pin::SetEdgeMode(Edge edge) {
     std::cerr << "Attempt to set edge mode for output pin at " + m_address << std::endl;
     return;
   }
+  if (m_simulated) {
+    return;
+  }
   // toggle back to none first to fix buggy driver state
   string strEdgePath = m_pinInterfacePath + "/edge";
   writeToFile(strEdgePath, "none");
@@ -85,6 +89,10 @@ pollfd Pin::GetPollInfo() {
 }
 
 void Pin::write(DigitalValue value) {
+  if (m_simulated) {
+    Simulator::Get().WritePin(m_address, value == HIGH);
+    return;
+  }
   if (m_fd < 0) {
     return;
   }
@@ -93,6 +101,9 @@ void Pin::write(DigitalValue value) {
 }
 
 DigitalValue Pin::read() {
+  if (m_simulated) {
+    return Simulator::Get().ReadPin(m_address) ? HIGH : LOW;
+  }
   if (m_fd < 0) {
     return LOW;
   }
@@ -125,6 +136,9 @@ int Pin::readFromFile(const std::string &strPath, void *buf, int nBytes) {
 }
 
 void Pin::open() {
+  if (m_simulated) {
+    return;
+  }
   int result;
   auto strExportPath = s_rootInterfacePath + "/export";
   auto strAddress = std::to_string(m_address);
@@ -151,6 +165,9 @@ void Pin::close() {
     ::close(m_fd);
     m_fd = -1;
   }
+  if (m_simulated) {
+    return;
+  }
   auto strUnexportPath = s_rootInterfacePath + "/unexport";
   auto strAddress = std::to_string(m_address);
   writeToFile(strUnexportPath, strAddress);
@@ -158,62 +175,130 @@ void Pin::close() {
 
 //======================
 
-static inline void i2c_smbus_transaction(int fd, char rw, uint8_t regAddr, union i2c_smbus_data *data, int size) {
-  i2c_smbus_ioctl_data args;
-  args.read_write = rw;
-  args.command = regAddr;
-  args.size = size;
-  args.data = data;
-  if (::ioctl(fd, I2C_SMBUS, &args)) {
-    std::cerr << "[ERROR] i2c SMBUS failed: " << std::strerror(errno) << std::endl;
-  }
-}
-
-I2CDevice::I2CDevice(uint8_t bus, uint8_t devAddr) : m_fd(-1) {
-  open(bus, devAddr);
+LineEvents::LineEvents(const std::string &chip, int line, Pin::Edge edge)
+  : m_fd(-1)
+{
+  open(chip, line, edge);
 }
 
-I2CDevice::~I2CDevice() {
+LineEvents::~LineEvents() {
   close();
 }
 
-uint8_t I2CDevice::ReadByte(uint8_t regAddr) {
-  i2c_smbus_data data;
-  i2c_smbus_transaction(m_fd, I2C_SMBUS_READ, regAddr, &data, I2C_SMBUS_BYTE_DATA);
-  return data.byte;
+pollfd LineEvents::GetPollInfo() {
+  return { m_fd, POLLIN, 0 };
 }
 
-void I2CDevice::Command(uint8_t cmd) {
-  i2c_smbus_transaction(m_fd, I2C_SMBUS_WRITE, cmd, nullptr, I2C_SMBUS_BYTE);
+bool LineEvents::Read(std::chrono::nanoseconds &timestamp, bool &rising) {
+  if (m_fd < 0) {
+    return false;
+  }
+  gpioevent_data event;
+  if (::read(m_fd, &event, sizeof(event)) != sizeof(event)) {
+    return false;
+  }
+  timestamp = std::chrono::nanoseconds(event.timestamp);
+  rising = event.id == GPIOEVENT_EVENT_RISING_EDGE;
+  return true;
 }
 
-void I2CDevice::WriteByte(uint8_t regAddr, uint8_t value) {
-  i2c_smbus_data data;
-  data.byte = value;
-  i2c_smbus_transaction(m_fd, I2C_SMBUS_WRITE, regAddr, &data, I2C_SMBUS_BYTE_DATA);
+DigitalValue LineEvents::ReadValue() {
+  if (m_fd < 0) {
+    return LOW;
+  }
+  gpiohandle_data data;
+  std::memset(&data, 0, sizeof(data));
+  if (::ioctl(m_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) {
+    std::cerr << "Failed to read GPIO line: " << std::strerror(errno) << std::endl;
+    return LOW;
+  }
+  return data.values[0] ? HIGH : LOW;
 }
 
-void I2CDevice::WriteBlock(uint8_t regAddr, const uint8_t *values, int nBytes) {
-  i2c_smbus_data data;
-  uint8_t length = std::min(nBytes, 32);
-  data.block[0] = length;
-  for (int i = 1; i <= length; i++) {
-    data.block[i] = values[i - 1];
+void LineEvents::open(const std::string &chip, int line, Pin::Edge edge) {
+  if (Hardware::IsSimulated()) {
+    return;
   }
-  i2c_smbus_transaction(m_fd, I2C_SMBUS_WRITE, regAddr, &data, I2C_SMBUS_I2C_BLOCK_DATA);
-}
+  int chipFd = ::open(chip.c_str(), O_RDONLY);
+  if (chipFd < 0) {
+    std::cerr << "Failed to open " << chip << ": " << std::strerror(errno) << std::endl;
+    return;
+  }
+
+  gpioevent_request request;
+  std::memset(&request, 0, sizeof(request));
+  request.lineoffset = line;
+  request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+  switch (edge) {
+    case Pin::RISING:
+      request.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+      break;
+    case Pin::FALLING:
+      request.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+      break;
+    case Pin::BOTH:
+    default:
+      request.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+      break;
+  }
+  std::strncpy(request.consumer_label, "missing_link", sizeof(request.consumer_label) - 1);
 
-void I2CDevice::open(uint8_t bus, uint8_t devAddr) {
-  string interface = "/dev/i2c-" + std::to_string(bus);
-  m_fd = ::open(interface.c_str(), O_RDWR | O_NONBLOCK);
-  if (::ioctl(m_fd, I2C_SLAVE, devAddr)) {
-    std::cerr << "[ERROR] Could not open I2C interface" << std::endl;
+  if (::ioctl(chipFd, GPIO_GET_LINEEVENT_IOCTL, &request) < 0) {
+    std::cerr << "Failed to request events for GPIO line " << line << ": " << std::strerror(errno) << std::endl;
+  } else {
+    m_fd = request.fd;
+    // Never block, the caller polls
+    ::fcntl(m_fd, F_SETFL, ::fcntl(m_fd, F_GETFL) | O_NONBLOCK);
   }
+  // The line stays requested through its own fd
+  ::close(chipFd);
 }
 
-void I2CDevice::close() {
+void LineEvents::close() {
   if (m_fd >= 0) {
     ::close(m_fd);
     m_fd = -1;
   }
 }
+
+I2CDevice::I2CDevice(uint8_t bus, uint8_t devAddr, I2CBus::Priority priority)
+  : m_address(devAddr)
+  , m_priority(priority)
+  , m_pBus(I2CBus::Get(bus))
+{
+  // So transfers never allocate them
+  m_pBus->GetStats(devAddr);
+}
+
+I2CDevice::~I2CDevice() {}
+
+uint8_t I2CDevice::ReadByte(uint8_t regAddr) {
+  uint8_t value;
+  m_pBus->Read(m_address, regAddr, &value, 1, m_priority);
+  return value;
+}
+
+void I2CDevice::ReadBlock(uint8_t regAddr, uint8_t *data, int nBytes) {
+  m_pBus->Read(m_address, regAddr, data, nBytes, m_priority);
+}
+
+void I2CDevice::Command(uint8_t cmd) {
+  m_pBus->Write(m_address, &cmd, 1, m_priority);
+}
+
+void I2CDevice::WriteByte(uint8_t regAddr, uint8_t value) {
+  WriteByte(regAddr, value, m_priority);
+}
+
+void I2CDevice::WriteByte(uint8_t regAddr, uint8_t value, I2CBus::Priority priority) {
+  const uint8_t data[2] = { regAddr, value };
+  m_pBus->Write(m_address, data, 2, priority);
+}
+
+void I2CDevice::WriteBlock(uint8_t regAddr, const uint8_t *values, int nBytes, I2CBus::SentHandler onSent) {
+  uint8_t data[33];
+  const int length = std::min(nBytes, 32);
+  data[0] = regAddr;
+  std::copy(values, values + length, data + 1);
+  m_pBus->Write(m_address, data, length + 1, m_priority, onSent);
+}
@@ -7,9 +7,12 @@
 
 #include <string>
 #include <memory>
+#include <chrono>
 #include <poll.h>
+#include "missing_link/i2c_bus.hpp"
 
 namespace MissingLink {
+
 namespace GPIO {
 
 enum DigitalValue {
@@ -49,6 +52,7 @@ class Pin {
     const int m_address;
     const Direction m_direction;
     const std::string m_pinInterfacePath;
+    const bool m_simulated;
 
     int m_fd;
 
@@ -63,27 +67,61 @@ class Pin {
 };
 
 
+// Edges on an input line through the GPIO character device. Unlike the
+// sysfs interface each edge comes with the kernel's timestamp of the
+// interrupt, so it doesn't matter when the reading thread gets to it.
+class LineEvents {
+
+  public:
+
+    LineEvents(const std::string &chip, int line, Pin::Edge edge);
+    virtual ~LineEvents();
+
+    bool IsOpen() const { return m_fd >= 0; }
+
+    pollfd GetPollInfo();
+
+    // Reads one pending edge. Returns false if there was none. The
+    // timestamp is CLOCK_MONOTONIC, or CLOCK_REALTIME before Linux 5.7.
+    bool Read(std::chrono::nanoseconds &timestamp, bool &rising);
+
+    // Current level of the line
+    DigitalValue ReadValue();
+
+  private:
+
+    int m_fd;
+
+    void open(const std::string &chip, int line, Pin::Edge edge);
+    void close();
+};
+
+
+// A device on a shared I2CBus. Reads block until done; writes do too,
+// except at Display priority, where they are queued on the bus.
 class I2CDevice {
 
   public:
 
-    I2CDevice(uint8_t bus, uint8_t devAddr);
+    I2CDevice(uint8_t bus, uint8_t devAddr, I2CBus::Priority priority = I2CBus::Priority::Display);
     virtual ~I2CDevice();
 
     void Command(uint8_t cmd);
 
     uint8_t ReadByte(uint8_t regAddr);
-//    void ReadBlock(uint8_t regAddr, uint8_t *data, int nBytes);
+    void ReadBlock(uint8_t regAddr, uint8_t *data, int nBytes);
 
     void WriteByte(uint8_t regAddr, uint8_t value);
-    void WriteBlock(uint8_t regAddr, const uint8_t *values, int nBytes);
+    // With another priority than the device's, e.g. for a latch driving clock edges
+    void WriteByte(uint8_t regAddr, uint8_t value, I2CBus::Priority priority);
+    void WriteBlock(uint8_t regAddr, const uint8_t *values, int nBytes,
+                    I2CBus::SentHandler onSent = nullptr);
 
   private:
 
-    int m_fd;
-
-    void open(uint8_t bus, uint8_t devAddr);
-    void close();
+    const uint8_t m_address;
+    const I2CBus::Priority m_priority;
+    std::shared_ptr<I2CBus> m_pBus;
 };
 
 }} // namespaces
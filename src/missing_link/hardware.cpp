@@ -0,0 +1,18 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include "missing_link/hardware.hpp"
+
+using namespace MissingLink;
+
+static Hardware::Backend s_backend = Hardware::Backend::Device;
+
+void Hardware::SetBackend(Backend backend) {
+  s_backend = backend;
+}
+
+Hardware::Backend Hardware::GetBackend() {
+  return s_backend;
+}
@@ -0,0 +1,22 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+namespace MissingLink {
+namespace Hardware {
+
+enum class Backend {
+  Device,     // sysfs GPIO, /dev/i2c-*, ALSA MIDI
+  Simulated   // in-process fakes, see simulator.hpp
+};
+
+// Must be picked at startup, before anything that touches hardware is created
+void SetBackend(Backend backend);
+Backend GetBackend();
+
+inline bool IsSimulated() { return GetBackend() == Backend::Simulated; }
+
+}} // namespaces
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <algorithm>
+#include "missing_link/histogram.hpp"
+
+using namespace MissingLink;
+
+LatencyHistogram::LatencyHistogram() {
+  Reset();
+}
+
+void LatencyHistogram::Record(std::chrono::microseconds latency) {
+  const long long count = latency.count();
+  const uint32_t micros = (uint32_t)std::min<long long>(std::max<long long>(0, count), UINT32_MAX);
+
+  m_buckets[bucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+
+  uint32_t max = m_max.load(std::memory_order_relaxed);
+  while (micros > max && !m_max.compare_exchange_weak(max, micros, std::memory_order_relaxed)) {}
+}
+
+LatencyHistogram::Summary LatencyHistogram::GetSummary() const {
+  Summary summary;
+  summary.count = m_count.load(std::memory_order_relaxed);
+  summary.max = std::chrono::microseconds(m_max.load(std::memory_order_relaxed));
+  summary.p50 = std::chrono::microseconds(0);
+  summary.p99 = std::chrono::microseconds(0);
+  if (summary.count == 0) {
+    return summary;
+  }
+
+  const uint64_t p50Rank = ((uint64_t)summary.count * 50 + 99) / 100;
+  const uint64_t p99Rank = ((uint64_t)summary.count * 99 + 99) / 100;
+  bool foundP50 = false;
+  uint64_t cumulative = 0;
+  for (int i = 0; i < NumBuckets; i++) {
+    cumulative += m_buckets[i].load(std::memory_order_relaxed);
+    if (!foundP50 && cumulative >= p50Rank) {
+      summary.p50 = std::chrono::microseconds(bucketUpperBound(i));
+      foundP50 = true;
+    }
+    if (cumulative >= p99Rank) {
+      summary.p99 = std::chrono::microseconds(bucketUpperBound(i));
+      break;
+    }
+  }
+
+  // Bucket bounds overestimate, never report past the real max
+  summary.p50 = std::min(summary.p50, summary.max);
+  summary.p99 = std::min(summary.p99, summary.max);
+  return summary;
+}
+
+void LatencyHistogram::Reset() {
+  for (auto &bucket : m_buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  m_count.store(0, std::memory_order_relaxed);
+  m_max.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketIndex(uint32_t micros) {
+  if (micros < NumExactBuckets) {
+    return micros;
+  }
+  const int exponent = 31 - __builtin_clz(micros);
+  const int shift = exponent - SubBucketBits;
+  const int subBucket = (micros >> shift) & ((1 << SubBucketBits) - 1);
+  return NumExactBuckets + (exponent - 4) * (1 << SubBucketBits) + subBucket;
+}
+
+uint32_t LatencyHistogram::bucketUpperBound(int index) {
+  if (index < NumExactBuckets) {
+    return index;
+  }
+  const int exponent = (index - NumExactBuckets) / (1 << SubBucketBits) + 4;
+  const int subBucket = (index - NumExactBuckets) % (1 << SubBucketBits);
+  const int shift = exponent - SubBucketBits;
+  const uint64_t lower = (uint64_t)((1 << SubBucketBits) + subBucket) << shift;
+  return (uint32_t)std::min<uint64_t>(lower + (1ULL << shift) - 1, UINT32_MAX);
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace MissingLink {
+
+// Fixed bucket latency histogram that can be recorded into from a realtime
+// thread without locks or allocation. Buckets are exact below 16us and
+// then split every power of two into 8, so percentiles are within 12.5%.
+class LatencyHistogram {
+
+  public:
+
+    struct Summary {
+      uint32_t count;
+      std::chrono::microseconds p50;
+      std::chrono::microseconds p99;
+      std::chrono::microseconds max;
+    };
+
+    LatencyHistogram();
+
+    // Negative latencies are recorded as zero
+    void Record(std::chrono::microseconds latency);
+
+    Summary GetSummary() const;
+
+    void Reset();
+
+  private:
+
+    static const int NumExactBuckets = 16;
+    static const int SubBucketBits = 3;
+    static const int NumBuckets = NumExactBuckets + (32 - 4) * (1 << SubBucketBits);
+
+    static int bucketIndex(uint32_t micros);
+    static uint32_t bucketUpperBound(int index);
+
+    std::atomic<uint32_t> m_buckets[NumBuckets];
+    std::atomic<uint32_t> m_count;
+    std::atomic<uint32_t> m_max;
+};
+
+}
@@ -0,0 +1,16 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+
+namespace MissingLink {
+
+  // Current Link host time, everything scheduled or timestamped is in it
+  typedef std::function<std::chrono::microseconds()> HostClock;
+
+}
@@ -7,3 +7,12 @@
 #define ML_CLOCK_PIN        23
 #define ML_RESET_PIN        24
 #define ML_LOGO_PIN         16
+#define ML_CLOCK_IN_PIN     22
+
+// Character device the pins above are lines of, for timestamped edge events
+#define ML_GPIO_CHIP "/dev/gpiochip0"
+
+// Clock channel 0 drives ML_CLOCK_PIN, the rest are backed by
+// consecutive MCP23008 pins starting at ML_EXPANDER_CLOCK_PIN
+#define ML_NUM_CLOCK_CHANNELS 4
+#define ML_EXPANDER_CLOCK_PIN 5
@@ -0,0 +1,381 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "missing_link/i2c_bus.hpp"
+#include "missing_link/hardware.hpp"
+#include "missing_link/simulator.hpp"
+#include "missing_link/types.hpp"
+
+using namespace MissingLink;
+
+namespace MissingLink {
+
+  // Queued writes sent per combined transaction. The bus is held for the
+  // whole transaction, so this bounds how long a button read can wait
+  // behind the display: about 3ms at 100kHz.
+  static const int MaxCombinedBytes = 36;
+  static const int MaxCombinedMessages = 8;
+
+  // Combined transactions failing this many times in a row, while the same
+  // writes go through one by one, mean the adapter doesn't take them
+  static const int MaxCombinedFailures = 3;
+
+  // How often the bus thread looks again while a synchronous transfer has
+  // the bus. Releasing it doesn't take m_mutex, so its wakeup can be missed.
+  static const std::chrono::milliseconds ClaimedPollInterval(1);
+
+}
+
+I2CBus::DeviceStats::DeviceStats()
+  : errors(0)
+  , coalesced(0)
+{}
+
+std::shared_ptr<I2CBus> I2CBus::Get(uint8_t bus) {
+  static std::mutex busesMutex;
+  static std::map<uint8_t, std::weak_ptr<I2CBus>> buses;
+
+  ScopedMutex lock(busesMutex);
+  auto pBus = buses[bus].lock();
+  if (!pBus) {
+    pBus = std::shared_ptr<I2CBus>(new I2CBus(bus));
+    buses[bus] = pBus;
+  }
+  return pBus;
+}
+
+I2CBus::I2CBus(uint8_t bus)
+  : m_bus(bus)
+  , m_simulated(Hardware::IsSimulated())
+  , m_fd(-1)
+  , m_combined(true)
+  , m_combinedFailures(0)
+  , m_stop(false)
+{
+  for (auto &waiting : m_waiting) {
+    waiting.store(0);
+  }
+  for (auto &pStats : m_statsByAddress) {
+    pStats.store(nullptr);
+  }
+  pthread_mutexattr_t attributes;
+  pthread_mutexattr_init(&attributes);
+  if (pthread_mutexattr_setprotocol(&attributes, PTHREAD_PRIO_INHERIT) != 0) {
+    std::cerr << "[WARN] I2C bus lock without priority inheritance" << std::endl;
+  }
+  pthread_mutex_init(&m_transferMutex, &attributes);
+  pthread_mutexattr_destroy(&attributes);
+  open();
+  m_thread = std::thread(&I2CBus::run, this);
+}
+
+I2CBus::~I2CBus() {
+  {
+    ScopedMutex lock(m_mutex);
+    m_stop = true;
+  }
+  m_condition.notify_all();
+  // Sends whatever is still queued, e.g. clearing the display
+  m_thread.join();
+  close();
+  pthread_mutex_destroy(&m_transferMutex);
+}
+
+I2CBus::DeviceStats &I2CBus::GetStats(uint8_t devAddr) {
+  if (devAddr < NumAddresses) {
+    DeviceStats *pStats = m_statsByAddress[devAddr].load(std::memory_order_acquire);
+    if (pStats != nullptr) {
+      return *pStats;
+    }
+  }
+  ScopedMutex lock(m_mutex);
+  return stats(devAddr);
+}
+
+bool I2CBus::Read(uint8_t devAddr, uint8_t regAddr, uint8_t *data, int nBytes, Priority priority) {
+  const auto requested = std::chrono::steady_clock::now();
+
+  i2c_msg msgs[2];
+  msgs[0].addr = devAddr;
+  msgs[0].flags = 0;
+  msgs[0].len = 1;
+  msgs[0].buf = &regAddr;
+  msgs[1].addr = devAddr;
+  msgs[1].flags = I2C_M_RD;
+  msgs[1].len = (uint16_t)nBytes;
+  msgs[1].buf = data;
+
+  acquire(priority);
+  const bool ok = transfer(msgs, 2);
+  release(priority);
+
+  if (!ok) {
+    std::fill(data, data + nBytes, 0);
+  }
+  finish(devAddr, requested, ok);
+  return ok;
+}
+
+bool I2CBus::Write(uint8_t devAddr, const uint8_t *data, int nBytes, Priority priority, SentHandler onSent) {
+  if (priority == Priority::Display) {
+    queue(devAddr, data, nBytes, onSent);
+    return true;
+  }
+
+  const auto requested = std::chrono::steady_clock::now();
+
+  i2c_msg msg;
+  msg.addr = devAddr;
+  msg.flags = 0;
+  msg.len = (uint16_t)nBytes;
+  msg.buf = const_cast<uint8_t*>(data);
+
+  acquire(priority);
+  const bool ok = transfer(&msg, 1);
+  release(priority);
+
+  finish(devAddr, requested, ok);
+  if (onSent) { onSent(); }
+  return ok;
+}
+
+void I2CBus::PrintStats(std::ostream &stream) {
+  // The stats live as long as the bus, only the list needs the lock.
+  // Writing to the stream may block, so it is done without.
+  std::vector<std::pair<uint8_t, DeviceStats*>> devices;
+  {
+    ScopedMutex lock(m_mutex);
+    for (auto &entry : m_stats) {
+      devices.push_back(std::make_pair(entry.first, entry.second.get()));
+    }
+  }
+  stream << "I2C bus " << (int)m_bus << ":\n";
+  for (auto &device : devices) {
+    const auto summary = device.second->latency.GetSummary();
+    stream << "  0x" << std::hex << (int)device.first << std::dec
+           << ": " << summary.count << " transfers"
+           << ", p50 " << summary.p50.count() << "us"
+           << ", p99 " << summary.p99.count() << "us"
+           << ", max " << summary.max.count() << "us"
+           << ", errors " << device.second->errors.load()
+           << ", coalesced " << device.second->coalesced.load() << "\n";
+  }
+}
+
+void I2CBus::ResetStats() {
+  ScopedMutex lock(m_mutex);
+  for (auto &entry : m_stats) {
+    entry.second->latency.Reset();
+    entry.second->errors.store(0);
+    entry.second->coalesced.store(0);
+  }
+}
+
+void I2CBus::open() {
+  if (m_simulated) { return; }
+  const std::string interface = "/dev/i2c-" + std::to_string(m_bus);
+  m_fd = ::open(interface.c_str(), O_RDWR);
+  if (m_fd < 0) {
+    std::cerr << "[ERROR] Could not open I2C interface " << interface
+              << ": " << std::strerror(errno) << std::endl;
+  }
+}
+
+void I2CBus::close() {
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+}
+
+void I2CBus::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    while (!(m_stop && m_queue.empty()) && (m_queue.empty() || isClaimed(Priority::Display))) {
+      if (m_queue.empty()) {
+        m_condition.wait(lock);
+      } else {
+        m_condition.wait_for(lock, ClaimedPollInterval);
+      }
+    }
+    if (m_queue.empty()) { break; }
+
+    // Oldest first, as many as fit in one transaction
+    int count = 0;
+    int bytes = 0;
+    while (count < (int)m_queue.size() && count < MaxCombinedMessages) {
+      bytes += m_queue[count].data.size();
+      if (count > 0 && bytes > MaxCombinedBytes) { break; }
+      count++;
+    }
+    std::vector<QueuedWrite> batch;
+    batch.reserve(count);
+    std::move(m_queue.begin(), m_queue.begin() + count, std::back_inserter(batch));
+    m_queue.erase(m_queue.begin(), m_queue.begin() + count);
+
+    lock.unlock();
+
+    std::vector<i2c_msg> msgs(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+      msgs[i].addr = batch[i].devAddr;
+      msgs[i].flags = 0;
+      msgs[i].len = (uint16_t)batch[i].data.size();
+      msgs[i].buf = batch[i].data.data();
+    }
+    pthread_mutex_lock(&m_transferMutex);
+    bool ok;
+    if (m_combined || msgs.size() == 1) {
+      ok = transfer(msgs.data(), msgs.size());
+      if (ok && msgs.size() > 1) {
+        m_combinedFailures = 0;
+      }
+    } else {
+      ok = false;
+    }
+    if (!ok && msgs.size() > 1) {
+      // Some adapters only take a write-read pair. A combined transaction
+      // failing just as one transient NAK would is retried one by one, and
+      // only given up on once that keeps happening.
+      ok = true;
+      for (auto &msg : msgs) {
+        ok = transfer(&msg, 1) && ok;
+      }
+      if (ok && m_combined && ++m_combinedFailures >= MaxCombinedFailures) {
+        std::cerr << "[WARN] I2C bus " << (int)m_bus << " sends one write per transaction" << std::endl;
+        m_combined = false;
+      }
+    }
+    pthread_mutex_unlock(&m_transferMutex);
+
+    for (auto &write : batch) {
+      DeviceStats &writeStats = GetStats(write.devAddr);
+      writeStats.latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - write.queued));
+      if (!ok) { writeStats.errors++; }
+    }
+    for (auto &write : batch) {
+      for (auto &onSent : write.sentHandlers) {
+        onSent();
+      }
+    }
+    lock.lock();
+  }
+}
+
+void I2CBus::acquire(Priority priority) {
+  // Keeps the bus thread from starting another batch meanwhile
+  m_waiting[(int)priority]++;
+  // Waits out a batch already on the bus, boosting the bus thread to our
+  // priority. Clock before input follows from their thread priorities.
+  pthread_mutex_lock(&m_transferMutex);
+}
+
+void I2CBus::release(Priority priority) {
+  pthread_mutex_unlock(&m_transferMutex);
+  m_waiting[(int)priority]--;
+  m_condition.notify_all();
+}
+
+bool I2CBus::isClaimed(Priority priority) const {
+  // Someone more important is waiting for the bus
+  for (int level = 0; level < (int)priority; level++) {
+    if (m_waiting[level].load() > 0) { return true; }
+  }
+  return false;
+}
+
+I2CBus::DeviceStats &I2CBus::stats(uint8_t devAddr) {
+  auto &pStats = m_stats[devAddr];
+  if (!pStats) {
+    pStats = std::unique_ptr<DeviceStats>(new DeviceStats());
+    if (devAddr < NumAddresses) {
+      m_statsByAddress[devAddr].store(pStats.get(), std::memory_order_release);
+    }
+  }
+  return *pStats;
+}
+
+void I2CBus::queue(uint8_t devAddr, const uint8_t *data, int nBytes, SentHandler onSent) {
+  if (nBytes <= 0) { return; }
+  {
+    ScopedMutex lock(m_mutex);
+    // Replace the device's last queued write if it covers exactly the same
+    // registers, keeping its place and age. Anything else goes behind it:
+    // replacing a longer block would drop its tail, and replacing one
+    // further up the queue would let a later overlapping write undo it.
+    auto it = std::find_if(m_queue.rbegin(), m_queue.rend(), [devAddr](const QueuedWrite &write) {
+      return write.devAddr == devAddr;
+    });
+    if (it != m_queue.rend() && it->data.size() == (size_t)nBytes && it->data[0] == data[0]) {
+      it->data.assign(data, data + nBytes);
+      if (onSent) { it->sentHandlers.push_back(onSent); }
+      stats(devAddr).coalesced++;
+    } else {
+      QueuedWrite write;
+      write.devAddr = devAddr;
+      write.data.assign(data, data + nBytes);
+      write.queued = std::chrono::steady_clock::now();
+      if (onSent) { write.sentHandlers.push_back(onSent); }
+      m_queue.push_back(std::move(write));
+    }
+  }
+  m_condition.notify_all();
+}
+
+bool I2CBus::transfer(i2c_msg *msgs, int count) {
+  if (m_simulated) {
+    return transferSimulated(msgs, count);
+  }
+  if (m_fd < 0) { return false; }
+
+  i2c_rdwr_ioctl_data transaction;
+  transaction.msgs = msgs;
+  transaction.nmsgs = count;
+  if (::ioctl(m_fd, I2C_RDWR, &transaction) < 0) {
+    std::cerr << "[ERROR] i2c transfer failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool I2CBus::transferSimulated(const i2c_msg *msgs, int count) {
+  Simulator::Get().CountI2CTransfer();
+  for (int i = 0; i < count; i++) {
+    const i2c_msg &msg = msgs[i];
+    SimulatedRegisters *pDevice = Simulator::Get().OpenI2CDevice(m_bus, msg.addr);
+    const bool addressesRead = i + 1 < count && (msgs[i + 1].flags & I2C_M_RD) && msgs[i + 1].addr == msg.addr;
+    if (msg.flags & I2C_M_RD) {
+      // Sequential read from the register the previous message addressed
+      const uint8_t regAddr = i > 0 ? msgs[i - 1].buf[0] : 0;
+      for (int n = 0; n < msg.len; n++) {
+        msg.buf[n] = pDevice->Read((uint8_t)(regAddr + n));
+      }
+    } else if (msg.len == 1 && !addressesRead) {
+      pDevice->Command(msg.buf[0]);
+    } else if (msg.len == 2) {
+      pDevice->Write(msg.buf[0], msg.buf[1]);
+    } else if (msg.len > 2) {
+      pDevice->WriteBlock(msg.buf[0], msg.buf + 1, msg.len - 1);
+    }
+  }
+  return true;
+}
+
+void I2CBus::finish(uint8_t devAddr, std::chrono::steady_clock::time_point requested, bool ok) {
+  DeviceStats &deviceStats = GetStats(devAddr);
+  deviceStats.latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - requested));
+  if (!ok) { deviceStats.errors++; }
+}
@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include "missing_link/histogram.hpp"
+
+struct i2c_msg;
+
+namespace MissingLink {
+
+// One I2C bus shared by every device on it. Transfers are scheduled by
+// priority instead of whoever gets to the kernel first: clock output and
+// input reads run on the calling thread as soon as the bus is free. Display
+// writes are queued instead and sent by the bus thread whenever nothing
+// else wants the bus, several to one combined I2C_RDWR transaction. The
+// bus itself is a priority inheriting mutex, so a realtime caller waiting
+// for a display transaction lends the bus thread its priority until done. A queued write of the
+// same registers as the device's last one still waiting replaces it, so a
+// busy view only ever sends its latest frame.
+class I2CBus {
+
+  public:
+
+    // Highest first
+    enum class Priority {
+      Clock,    // output latch driving clock edges
+      Input,    // button and encoder reads
+      Display,  // LEDs and segment display, queued
+    };
+
+    struct DeviceStats {
+      LatencyHistogram latency;   // from request to done, waiting included
+      std::atomic<uint32_t> errors;
+      std::atomic<uint32_t> coalesced;  // queued writes replaced by a later one
+
+      DeviceStats();
+    };
+
+    // Shared bus for the bus number, opened on first use and closed with
+    // the last device on it
+    static std::shared_ptr<I2CBus> Get(uint8_t bus);
+
+    virtual ~I2CBus();
+
+    // Stats of a device, created on first use and alive as long as the bus.
+    // Devices create theirs up front, so transfers never have to.
+    DeviceStats &GetStats(uint8_t devAddr);
+
+    // Write register address regAddr then read nBytes back, in one
+    // transaction. Blocks until done. Returns false on error.
+    bool Read(uint8_t devAddr, uint8_t regAddr, uint8_t *data, int nBytes, Priority priority);
+
+    typedef std::function<void()> SentHandler;
+
+    // Write nBytes of data, the first one being the register address or
+    // command. Blocks until done unless the priority is Display, then it
+    // is queued. Returns false on error. onSent is called once the data
+    // is on the bus, from the bus thread for queued writes.
+    bool Write(uint8_t devAddr, const uint8_t *data, int nBytes, Priority priority,
+               SentHandler onSent = nullptr);
+
+    void PrintStats(std::ostream &stream);
+    void ResetStats();
+
+  private:
+
+    static const int NumPriorities = 3;
+    static const int NumAddresses = 128;
+
+    struct QueuedWrite {
+      uint8_t devAddr;
+      std::vector<uint8_t> data;
+      std::chrono::steady_clock::time_point queued;
+      std::vector<SentHandler> sentHandlers;  // of this write and the ones it replaced
+    };
+
+    I2CBus(uint8_t bus);
+
+    void open();
+    void close();
+    void run();
+
+    void acquire(Priority priority);
+    void release(Priority priority);
+    bool isClaimed(Priority priority) const;
+    DeviceStats &stats(uint8_t devAddr);  // with m_mutex held
+
+    void queue(uint8_t devAddr, const uint8_t *data, int nBytes, SentHandler onSent);
+    bool transfer(i2c_msg *msgs, int count);
+    bool transferSimulated(const i2c_msg *msgs, int count);
+    void finish(uint8_t devAddr, std::chrono::steady_clock::time_point requested, bool ok);
+
+    const uint8_t m_bus;
+    const bool m_simulated;
+    int m_fd;
+    // Cleared if the adapter doesn't take several writes in one transaction.
+    // Only the bus thread sends combined transactions.
+    bool m_combined;
+    int m_combinedFailures;   // in a row, while the same writes went through one by one
+
+    // Held for every transfer, with priority inheritance like the kernel's
+    // own adapter lock. Waiters get it highest thread priority first.
+    pthread_mutex_t m_transferMutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop;
+    std::vector<QueuedWrite> m_queue;
+    std::map<uint8_t, std::unique_ptr<DeviceStats>> m_stats;  // owns the stats, m_mutex held
+
+    // Touched by realtime callers, so never behind m_mutex
+    std::atomic<int> m_waiting[NumPriorities];   // synchronous transfers waiting or running
+    std::atomic<DeviceStats*> m_statsByAddress[NumAddresses];
+
+    std::thread m_thread;
+};
+
+}
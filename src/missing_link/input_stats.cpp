@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include "missing_link/input_stats.hpp"
+
+using namespace MissingLink;
+
+namespace {
+
+  // A frame this long after the input isn't its result, e.g. the action
+  // didn't change the display
+  const std::chrono::microseconds DisplayTraceTimeout(500000);
+
+  void printLatency(std::ostream &stream, const char *name, const LatencyHistogram &histogram) {
+    const auto summary = histogram.GetSummary();
+    stream << "  " << name << ": " << summary.count << " inputs"
+           << ", p50 " << summary.p50.count() << "us"
+           << ", p99 " << summary.p99.count() << "us"
+           << ", max " << summary.max.count() << "us\n";
+  }
+
+}
+
+InputStats::InputStats(HostClock hostClock)
+  : m_hostClock(hostClock)
+  , m_displayEdge(0)
+{}
+
+void InputStats::ExpectDisplay(std::chrono::microseconds edgeTime) {
+  m_displayEdge.store(edgeTime.count());
+}
+
+void InputStats::DisplaySent() {
+  const long long edge = m_displayEdge.exchange(0);
+  if (edge == 0) { return; }
+  const auto latency = m_hostClock() - std::chrono::microseconds(edge);
+  if (latency < DisplayTraceTimeout) {
+    display.Record(latency);
+  }
+}
+
+void InputStats::Print(std::ostream &stream) const {
+  stream << "Input latency:\n";
+  printLatency(stream, "wakeup", wakeup);
+  printLatency(stream, "expander read", read);
+  printLatency(stream, "dispatch", dispatch);
+  printLatency(stream, "action", action);
+  printLatency(stream, "edge to action", total);
+  printLatency(stream, "edge to display", display);
+}
+
+void InputStats::Reset() {
+  wakeup.Reset();
+  read.Reset();
+  dispatch.Reset();
+  action.Reset();
+  total.Reset();
+  display.Reset();
+}
@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include "missing_link/histogram.hpp"
+#include "missing_link/host_clock.hpp"
+
+namespace MissingLink {
+
+  /// Where the time goes between pressing a button or turning the encoder
+  /// and the result, one histogram per stage. Written by the reactor
+  /// thread, except the display stage, and read from anywhere.
+  struct InputStats {
+
+    LatencyHistogram wakeup;    // interrupt edge to the reactor handling it
+    LatencyHistogram read;      // expander read
+    LatencyHistogram dispatch;  // read done to the control's callback
+    LatencyHistogram action;    // engine action, e.g. setTempo committing to Link
+    LatencyHistogram total;     // interrupt edge to the action done
+    LatencyHistogram display;   // interrupt edge to the next display frame on the bus
+
+    InputStats(HostClock hostClock);
+
+    // An input from the given edge is about to be acted on, the next
+    // display frame sent shows the result
+    void ExpectDisplay(std::chrono::microseconds edgeTime);
+
+    // A display frame went out on the bus. Safe from any thread.
+    void DisplaySent();
+
+    void Print(std::ostream &stream) const;
+    void Reset();
+
+  private:
+
+    HostClock m_hostClock;
+    std::atomic<long long> m_displayEdge;  // edge waiting for its frame, in us, 0 if none
+  };
+
+}
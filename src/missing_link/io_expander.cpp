@@ -33,8 +33,10 @@ enum IOExpander::ConfigOption : uint8_t {
   SEQOP_DISABLE   = 0b00100000 // Sequential operation (1 = disable address incrementing)
 };
 
-IOExpander::IOExpander(uint8_t i2cBus, uint8_t i2cAddress)
-  : m_i2cDevice(unique_ptr<I2CDevice>(new I2CDevice(i2cBus, i2cAddress)))
+IOExpander::IOExpander(I2CBus::Priority priority, uint8_t i2cBus, uint8_t i2cAddress)
+  : m_i2cDevice(unique_ptr<I2CDevice>(new I2CDevice(i2cBus, i2cAddress, priority)))
+  , m_outputLatch(m_i2cDevice->ReadByte(OLAT))
+  , m_outputPriority(priority)
 {}
 
 IOExpander::~IOExpander() {}
@@ -47,12 +49,24 @@ void IOExpander::Configure(const Configuration &config) {
   m_i2cDevice->WriteByte(INTCON, config.iocMode);
   m_i2cDevice->WriteByte(GPPU, config.pullUpEnabled);
 
+  // SEQOP_DISABLE stays clear for ReadInterrupt()
   uint8_t opts = 0x00;
   if (config.intConfig.activeHigh) opts |= INT_ACTIVE_HIGH;
   if (config.intConfig.openDrain) opts |= INT_OPEN_DRAIN;
   m_i2cDevice->WriteByte(IOCON, opts);
 }
 
+IOExpander::InterruptState IOExpander::ReadInterrupt() {
+  uint8_t registers[3];
+  m_i2cDevice->ReadBlock(INTF, registers, 3);
+
+  InterruptState state;
+  state.flag = registers[0];
+  state.captured = registers[1];
+  state.current = registers[2];
+  return state;
+}
+
 uint8_t IOExpander::ReadInterruptFlag() {
   return m_i2cDevice->ReadByte(INTF);
 }
@@ -70,16 +84,21 @@ bool IOExpander::ReadPin(int index) {
 }
 
 void IOExpander::WritePin(int index, bool on) {
-  uint8_t state = m_i2cDevice->ReadByte(OLAT);
+  uint8_t state = m_outputLatch;
   uint8_t pin = 1 << index;
   if (on) {
     state &= ~pin;
   } else {
     state |= pin;
   }
-  m_i2cDevice->WriteByte(OLAT, state);
+  WriteOutput(state);
 }
 
 void IOExpander::WriteOutput(uint8_t output) {
-  m_i2cDevice->WriteByte(OLAT, output);
+  m_outputLatch = output;
+  m_i2cDevice->WriteByte(OLAT, output, m_outputPriority);
+}
+
+void IOExpander::SetOutputPriority(I2CBus::Priority priority) {
+  m_outputPriority = priority;
 }
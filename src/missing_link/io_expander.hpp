@@ -10,6 +10,7 @@
 #include <thread>
 #include <vector>
 #include "missing_link/hw_defs.h"
+#include "missing_link/i2c_bus.hpp"
 
 namespace MissingLink {
 
@@ -41,12 +42,28 @@ class IOExpander {
       InterruptConfiguration intConfig;
     };
 
-    IOExpander(uint8_t i2cBus = ML_DEFAULT_I2C_BUS, uint8_t i2cAddress = 0x20);
+    // Registers read on an interrupt, INTF through GPIO
+    struct InterruptState {
+      uint8_t flag;       // pins that generated the interrupt
+      uint8_t captured;   // port state at the time of the interrupt
+      uint8_t current;    // port state when read
+    };
+
+    // One instance per chip, shared by everyone using it, so there is only
+    // one output latch shadow. Reads and configuration get the bus with the
+    // given priority.
+    IOExpander(I2CBus::Priority priority = I2CBus::Priority::Input,
+               uint8_t i2cBus = ML_DEFAULT_I2C_BUS, uint8_t i2cAddress = 0x20);
     virtual ~IOExpander();
 
-    // Configure expander options
+    // Configure expander options. Sequential addressing stays enabled,
+    // ReadInterrupt() depends on it.
     void Configure(const Configuration &config);
 
+    // Read INTF, INTCAP and GPIO in one sequential transfer.
+    // Reading this will clear the interrupt.
+    InterruptState ReadInterrupt();
+
     // Read from the INTF register.
     // A set bit indicates that the corresponding pin generated the interrupt.
     uint8_t ReadInterruptFlag();
@@ -66,12 +83,17 @@ class IOExpander {
     bool ReadPin(int index);
 
     // Turn an output on or off. This will write directly to the output
-    // latch without modifying other pin states.
+    // latch without modifying other pin states. The latch isn't read back,
+    // the other pins keep what this instance last wrote.
     void WritePin(int index, bool on);
 
     // Write a full byte to output latch.
     void WriteOutput(uint8_t output);
 
+    // Priority of output latch writes, e.g. Clock when the outputs drive
+    // clock edges. Outputs are only ever written from one thread.
+    void SetOutputPriority(I2CBus::Priority priority);
+
     static bool PinIsOn(int pinIndex, uint8_t gpioState) {
       uint8_t mask = (1 << pinIndex);
       return (mask & gpioState) != 0;
@@ -83,6 +105,10 @@ class IOExpander {
     enum ConfigOption : uint8_t;
 
     std::unique_ptr<GPIO::I2CDevice> m_i2cDevice;
+
+    // Last value written to OLAT
+    uint8_t m_outputLatch;
+    I2CBus::Priority m_outputPriority;
 };
 
 }
@@ -4,9 +4,13 @@
  */
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <vector>
 #include "missing_link/gpio.hpp"
 #include "missing_link/io_expander.hpp"
 #include "missing_link/led_driver.hpp"
+#include "missing_link/types.hpp"
 
 using namespace std;
 using namespace MissingLink;
@@ -22,9 +26,22 @@ enum LEDDriver::Register : uint8_t {
   LEDOUT3   = 0x17, // LED Output state 3
 };
 
+namespace MissingLink {
+
+  // Control register flag: the address auto-increments over the PWM
+  // registers only, so a block write can start at any of them
+  static const uint8_t AutoIncrementPWM = 0xA0;
+
+}
+
 LEDDriver::LEDDriver(uint8_t i2cBus, uint8_t i2cAddress)
   : m_i2cDevice(unique_ptr<I2CDevice>(new I2CDevice(i2cBus, i2cAddress)))
-{}
+  , m_pShown(make_shared<Shown>())
+{
+  std::memset(m_frame, 0, sizeof(m_frame));
+  std::memset(m_pShown->levels, 0, sizeof(m_pShown->levels));
+  m_pShown->valid = false;
+}
 
 LEDDriver::~LEDDriver() {}
 
@@ -39,7 +56,41 @@ void LEDDriver::Configure() {
 }
 
 void LEDDriver::SetBrightness(float brightness, int index) {
-  uint8_t address = PWMSTART + index;
-  uint8_t scaledBrightness = (uint8_t)(brightness * 255.0);
-  m_i2cDevice->WriteByte(address, scaledBrightness);
+  if (index < 0 || index >= NumChannels) { return; }
+  m_frame[index] = (uint8_t)(std::min(1.0f, std::max(0.0f, brightness)) * 255.0);
+}
+
+void LEDDriver::SetLevel(uint8_t level, int index) {
+  if (index < 0 || index >= NumChannels) { return; }
+  m_frame[index] = level;
+}
+
+void LEDDriver::Flush() {
+  uint8_t shown[NumChannels];
+  bool shownValid;
+  {
+    ScopedMutex lock(m_pShown->mutex);
+    std::memcpy(shown, m_pShown->levels, sizeof(shown));
+    shownValid = m_pShown->valid;
+  }
+
+  // Against what was sent, so a span still queued is sent again as part
+  // of this one, and the bus can replace the queued write with it
+  int first = 0;
+  int last = NumChannels - 1;
+  if (shownValid) {
+    while (first < NumChannels && m_frame[first] == shown[first]) { first++; }
+    if (first == NumChannels) { return; }
+    while (m_frame[last] == shown[last]) { last--; }
+  }
+  // One transaction for the whole dirty span, the unchanged LEDs in
+  // between cost a byte each, much less than a transaction of their own
+  const int count = last - first + 1;
+  auto pShown = m_pShown;
+  vector<uint8_t> levels(&m_frame[first], &m_frame[first] + count);
+  m_i2cDevice->WriteBlock(AutoIncrementPWM | (PWMSTART + first), &m_frame[first], count, [pShown, first, levels]() {
+    ScopedMutex lock(pShown->mutex);
+    std::copy(levels.begin(), levels.end(), &pShown->levels[first]);
+    pShown->valid = true;
+  });
 }
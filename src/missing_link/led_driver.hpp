@@ -6,6 +6,8 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
+#include <cstdint>
 #include "missing_link/hw_defs.h"
 
 namespace MissingLink {
@@ -25,14 +27,35 @@ class LEDDriver {
     // Defaults to oscillator on, all LEDs under individual/group PWM control
     void Configure();
 
-    // Set brightness (0 - 1) for an individual LED
+    // Set brightness (0 - 1) for an individual LED in the frame.
+    // Nothing is sent until Flush().
     void SetBrightness(float brightness, int index);
 
+    // Set the raw 8-bit PWM value of an LED, e.g. already gamma corrected
+    void SetLevel(uint8_t level, int index);
+
+    // Send the LEDs that changed since the last flush, as one auto-increment
+    // block write. An unchanged frame costs no bus traffic at all.
+    void Flush();
+
   private:
 
     enum Register : uint8_t;
 
+    static const int NumChannels = 16;
+
     std::unique_ptr<GPIO::I2CDevice> m_i2cDevice;
+
+    // Brightness on the driver, updated from the bus thread once a flush is
+    // sent. Shared with the pending writes, which may outlive the driver.
+    struct Shown {
+      std::mutex mutex;
+      uint8_t levels[NumChannels];
+      bool valid;                     // false until the first flush is sent
+    };
+
+    uint8_t m_frame[NumChannels];     // brightness to show
+    std::shared_ptr<Shown> m_pShown;
 };
 
 }
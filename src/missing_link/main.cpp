@@ -4,9 +4,41 @@
  */
 
 #include <iostream>
+#include <cctype>
+#include <string>
 #include "missing_link/engine.hpp"
+#include "missing_link/hardware.hpp"
+#include "missing_link/benchmark.hpp"
+
+static void printUsage(const char *name) {
+  std::cerr << "Usage: " << name << " [--simulate] [--benchmark [window ms]]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  bool benchmark = false;
+  int windowMillis = 1000;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--simulate") {
+      MissingLink::Hardware::SetBackend(MissingLink::Hardware::Backend::Simulated);
+    } else if (arg == "--benchmark") {
+      benchmark = true;
+      MissingLink::Hardware::SetBackend(MissingLink::Hardware::Backend::Simulated);
+      if (i + 1 < argc && std::isdigit(argv[i + 1][0])) {
+        windowMillis = std::stoi(argv[++i]);
+      }
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (benchmark) {
+    MissingLink::Benchmark bench(std::chrono::milliseconds(windowMillis), std::cout);
+    return bench.Run() ? 0 : 2;
+  }
 
-int main(void) {
   MissingLink::Engine engine;
   engine.Run();
   return 0;
@@ -0,0 +1,189 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <iostream>
+#include "missing_link/midi_in.hpp"
+#include "missing_link/hardware.hpp"
+
+using namespace MissingLink;
+
+namespace MissingLink {
+
+  // MIDI clock runs at 24 ticks per quarter note
+  static const int MidiClockPPQN = 24;
+
+  // Song position pointer counts sixteenths
+  static const int MidiClocksPerSongPosition = 6;
+
+  // A source that stops ticking for this long is dropped, so another can take over
+  static const std::chrono::microseconds MidiClockTimeout(500000);
+
+  // Bounds how often the tracked clock is committed to the Link session
+  static const std::chrono::microseconds MidiClockReportInterval(100000);
+
+}
+
+MidiClockIn::MidiClockIn(HostClock hostClock)
+  : m_hostClock(hostClock)
+  , m_simulated(Hardware::IsSimulated())
+  , m_opened(false)
+  , m_numPorts(0)
+  , m_tracker(MidiClockPPQN)
+  , m_positioned(false)
+  , m_activeInput(0)
+  , m_lastTick(0)
+  , m_lastReport(0)
+{}
+
+MidiClockIn::~MidiClockIn() {
+  closePorts();
+}
+
+void MidiClockIn::CheckPorts() {
+  unsigned int nPorts = countPorts();
+  if (!m_opened) {
+    initPorts();
+  } else if (nPorts != m_numPorts) {
+    std::cout << "MIDI inputs changed, reopening ports." << std::endl;
+    initPorts();
+  }
+}
+
+void MidiClockIn::midiCallback(double deltaTime, std::vector<unsigned char> *pMessage, void *pUserData) {
+  (void)deltaTime;
+  Input *pInput = static_cast<Input*>(pUserData);
+  if (pMessage == nullptr || pMessage->empty()) { return; }
+  pInput->pOwner->receive(pInput->index, *pMessage);
+}
+
+void MidiClockIn::receive(unsigned int input, const std::vector<unsigned char> &message) {
+  // Taken before anything else so waiting on the lock doesn't skew it
+  const auto now = m_hostClock();
+  const unsigned char status = message[0];
+
+  bool report = false;
+  ExternalClock info;
+  std::function<void()> transport;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (input != m_activeInput) {
+      if (now - m_lastTick < MidiClockTimeout) {
+        // Another source is in charge
+        return;
+      }
+      m_activeInput = input;
+      m_tracker.Reset();
+      m_positioned = false;
+    }
+
+    switch (status) {
+      case 0xF8:
+        if (now - m_lastTick >= MidiClockTimeout) {
+          // Clock came back after a pause, its old period means nothing now
+          m_tracker.Reset();
+        }
+        m_lastTick = now;
+        m_tracker.Tick(now);
+        if (m_tracker.IsLocked() && now - m_lastReport >= MidiClockReportInterval) {
+          m_lastReport = now;
+          info.tempo = m_tracker.GetTempo();
+          info.beat = m_tracker.GetBeat();
+          info.positioned = m_positioned;
+          info.ticksPerBeat = MidiClockPPQN;
+          info.time = m_tracker.GetTickTime();
+          report = true;
+        }
+        break;
+      case 0xFA:
+        // Start, the next clock is the first tick of the song
+        m_tracker.SetNextTick(0);
+        m_positioned = true;
+        transport = onStart;
+        break;
+      case 0xFB:
+        transport = onStart;
+        break;
+      case 0xFC:
+        transport = onStop;
+        break;
+      case 0xF2:
+        if (message.size() >= 3) {
+          const long long position = (long long)message[1] | ((long long)message[2] << 7);
+          m_tracker.SetNextTick(position * MidiClocksPerSongPosition);
+          m_positioned = true;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Called without the lock, they commit to Link and may take a while
+  if (report && onClock) { onClock(info); }
+  if (transport) { transport(); }
+}
+
+unsigned int MidiClockIn::countPorts() {
+  if (m_simulated) {
+    return 0;
+  }
+  try {
+    auto midi = std::unique_ptr<RtMidiIn>(new RtMidiIn());
+    return midi->getPortCount();
+  } catch (RtMidiError &error) {
+    error.printMessage();
+    return 0;
+  }
+}
+
+void MidiClockIn::initPorts() {
+  closePorts();
+  m_numPorts = countPorts();
+  m_opened = true;
+  if (m_simulated) { return; }
+
+  // Port 0 is the internal software port, the virtual port takes its place
+  // so software on the unit can drive it, e.g. aconnect a sequencer to it
+  for (unsigned int i = 0; i < m_numPorts; i++) {
+    auto pInput = std::unique_ptr<Input>(new Input());
+    pInput->pOwner = this;
+    pInput->index = i;
+    try {
+      pInput->pMidi = std::unique_ptr<RtMidiIn>(new RtMidiIn());
+      if (i == 0) {
+        pInput->pMidi->openVirtualPort("Missing Link Clock In");
+      } else {
+        const std::string name = pInput->pMidi->getPortName(i);
+        if (name.find("Missing Link") != std::string::npos) {
+          // Our own clock output, following it would be a feedback loop
+          continue;
+        }
+        std::cout << "Listening for MIDI clock on port " << i << ", " << name << std::endl;
+        pInput->pMidi->openPort(i);
+      }
+      // Let timing clock through, drop sysex and active sensing
+      pInput->pMidi->ignoreTypes(true, false, true);
+      pInput->pMidi->setCallback(&MidiClockIn::midiCallback, pInput.get());
+    } catch (RtMidiError &error) {
+      error.printMessage();
+      continue;
+    }
+    m_inputs.push_back(std::move(pInput));
+  }
+}
+
+void MidiClockIn::closePorts() {
+  // Closing a port stops its input thread, so no callback runs after this
+  for (auto &pInput : m_inputs) {
+    pInput->pMidi->cancelCallback();
+    pInput->pMidi->closePort();
+  }
+  m_inputs.clear();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_tracker.Reset();
+  m_positioned = false;
+}
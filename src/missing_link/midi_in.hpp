@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <rtmidi/RtMidi.h>
+#include "missing_link/types.hpp"
+#include "missing_link/host_clock.hpp"
+#include "missing_link/tempo_tracker.hpp"
+
+namespace MissingLink {
+
+  // Follows MIDI clock from every hardware input port plus a virtual
+  // "Clock In" port. Clock bytes are timestamped on arrival and tracked by
+  // a TempoTracker. Only one source is followed at a time, the first one to
+  // tick, until it goes quiet. Callbacks run on RtMidi's input threads.
+  class MidiClockIn {
+
+    public:
+
+      MidiClockIn(HostClock hostClock);
+      virtual ~MidiClockIn();
+
+      // Opens the ports the first time, so the callbacks can be set
+      // beforehand, and reopens them on hotplug
+      void CheckPorts();
+
+      // Tracked clock once locked, a few times a second
+      std::function<void(const ExternalClock&)> onClock;
+      std::function<void()> onStart;
+      std::function<void()> onStop;
+
+    private:
+
+      struct Input {
+        MidiClockIn *pOwner;
+        unsigned int index;
+        std::unique_ptr<RtMidiIn> pMidi;
+      };
+
+      static void midiCallback(double deltaTime, std::vector<unsigned char> *pMessage, void *pUserData);
+      void receive(unsigned int input, const std::vector<unsigned char> &message);
+      unsigned int countPorts();
+      void initPorts();
+      void closePorts();
+
+      HostClock m_hostClock;
+      const bool m_simulated;
+      bool m_opened;
+      unsigned int m_numPorts;
+      std::vector<std::unique_ptr<Input>> m_inputs;
+
+      std::mutex m_mutex;
+      TempoTracker m_tracker;
+      bool m_positioned;
+      unsigned int m_activeInput;
+      std::chrono::microseconds m_lastTick;
+      std::chrono::microseconds m_lastReport;
+  };
+
+}
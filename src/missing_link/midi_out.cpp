@@ -1,88 +1,76 @@
 // midiout.cpp
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
 #include "missing_link/midi_out.hpp"
+#include "missing_link/simulator.hpp"
 
 using namespace MissingLink;
 
-MidiOut::MidiOut()
+MidiOut::MidiOut(std::shared_ptr<OutputStats> pStats, HostClock hostClock, bool useSequencer)
   : m_numPorts(1)
-  , m_block_midi(true)
-  , m_ports()
+  , m_simulated(Hardware::IsSimulated())
+  , m_pStats(pStats)
+  , m_hostClock(hostClock)
+  , m_ports(std::unique_ptr<PortSet>(new PortSet()))
 {
+  if (useSequencer && !m_simulated) {
+    m_pSequencer = std::shared_ptr<AlsaSequencer>(new AlsaSequencer(hostClock));
+    if (!m_pSequencer->IsOpen()) {
+      std::cerr << "Falling back to unscheduled MIDI output" << std::endl;
+      m_pSequencer.reset();
+    }
+  }
   init_ports();
 }
 
 MidiOut::~MidiOut() {
-  m_block_midi = true;
   close_ports();
 }
 
-void MidiOut::ClockOut() {
-  //send clock to all open hardware ports (ignore port 0, so numPorts needs to be 2 or more)
-  if (m_block_midi || (m_numPorts < 2)) {
-    return;
-  }
-  m_message.clear();
-  m_message.push_back( 0xF8 );
-  for(auto & port : m_ports) {
-    try {
-      port->sendMessage( &m_message );
-    } catch (RtMidiError &error) {
-      error.printMessage();
-      init_ports();
-      break;
-    }
-  }
+void MidiOut::ClockOut(std::chrono::microseconds time) {
+  send(time, 0xF8);
 }
 
-void MidiOut::StartTransport() {
-  //send Start Transport to all open hardware ports (ignore port 0, so numPorts needs to be 2 or more)
-  if (m_block_midi || (m_numPorts < 2)) {
-    return;
-  }
-  m_message.clear();
-  m_message.push_back( 0xFA );
-  for(auto & port : m_ports) {
-    try {
-      port->sendMessage( &m_message );
-    } catch (RtMidiError &error) {
-      error.printMessage();
-      init_ports();
-      break;
-    }
-  }
+void MidiOut::StartTransport(std::chrono::microseconds time) {
+  send(time, 0xFA);
+}
+
+void MidiOut::StopTransport(std::chrono::microseconds time) {
+  send(time, 0xFC);
 }
 
-void MidiOut::StopTransport() {
-  //send Stop Transport to all open hardware ports (ignore port 0, so numPorts needs to be 2 or more)
-  if (m_block_midi || (m_numPorts < 2)) {
+void MidiOut::ScheduleClock(std::chrono::microseconds time) {
+  if (!m_pSequencer->Schedule(0xF8, time)) {
+    m_pStats->missedEdges++;
     return;
   }
-  //output clock messages
-  m_message.clear();
-  m_message.push_back( 0xFC );
-  for(auto & port : m_ports) {
-    try {
-      port->sendMessage( &m_message );
-    } catch (RtMidiError &error) {
-      error.printMessage();
-      init_ports();
-      break;
-    }
-  }
+  // The queue delivers on time whatever it was handed ahead of time, and
+  // anything handed over late right away. Zero unless the planner fell behind.
+  m_pStats->midiClockLatency.Record(m_hostClock() - time);
+}
+
+void MidiOut::CancelScheduledClock() {
+  m_pSequencer->CancelScheduled();
 }
 
 void MidiOut::AllNotesOff() {
-  if (m_block_midi || (m_numPorts < 2)) {
-    return;
-  }
   //output All Notes Off messages
 }
 
 void MidiOut::CheckPorts() {
   unsigned int nPorts = CountPorts();
-  if (nPorts != m_numPorts) {
+  bool failed = false;
+  {
+    RcuPointer<PortSet>::ReadLock ports(m_ports);
+    for (auto &port : ports->ports) {
+      failed = failed || port.sender->HasFailed();
+    }
+  }
+  if (failed) {
+    std::cout << "MIDI interface failed, reopening it." << std::endl;
+    init_ports();
+  } else if (nPorts != m_numPorts) {
     if (nPorts < m_numPorts){
       std::cout << "Lost MIDI interface." << std::endl;
     } else {
@@ -95,6 +83,9 @@ void MidiOut::CheckPorts() {
 }
 
 unsigned int MidiOut::CountPorts() {
+  if (m_simulated) {
+    return 2; // software port plus the simulated sink
+  }
   unsigned int count;
   auto midi = std::shared_ptr<RtMidiOut>(new RtMidiOut());
   count = midi->getPortCount();
@@ -102,25 +93,97 @@ unsigned int MidiOut::CountPorts() {
   return count;
 }
 
+void MidiOut::send(std::chrono::microseconds time, unsigned char status) {
+  //send to all open hardware ports, the set can be swapped out under us
+  //but is never freed while we hold it
+  RcuPointer<PortSet>::ReadLock ports(m_ports);
+  const MidiEvent event = { time, status };
+  for (auto &port : ports->ports) {
+    if (!port.sender->Send(event)) {
+      // Sender fell behind, the message is dropped rather than waiting on it
+      m_pStats->missedEdges++;
+    }
+  }
+}
+
 void MidiOut::init_ports() {
-  m_block_midi = true;
-  close_ports();
-  // Add all available ports, excluding port 0 (internal software port)
+  // Build the new set while the old one keeps sending, then swap. Ports
+  // that are still there and working keep their sender, and with it the
+  // messages it has queued; only failed and new ones are opened.
+  std::vector<PortSet::Port> healthy;
+  {
+    RcuPointer<PortSet>::ReadLock ports(m_ports);
+    for (auto &port : ports->ports) {
+      if (!port.sender->HasFailed()) {
+        healthy.push_back(port);
+      }
+    }
+  }
+  auto takeHealthy = [&healthy](const std::string &name) {
+    std::shared_ptr<MidiPortSender> sender;
+    auto it = std::find_if(healthy.begin(), healthy.end(), [&name](const PortSet::Port &port) {
+      return port.name == name;
+    });
+    if (it != healthy.end()) {
+      sender = it->sender;
+      healthy.erase(it);
+    }
+    return sender;
+  };
+
+  auto pPorts = std::unique_ptr<PortSet>(new PortSet());
   unsigned int nPorts = CountPorts();
-  if (nPorts != 1) { std::cout << "Found " << nPorts << " MIDI port(s)" << std::endl; }
   m_numPorts = nPorts;
+  if (m_simulated) {
+    const std::string name = "simulator";
+    auto sender = takeHealthy(name);
+    if (!sender) {
+      sender = std::make_shared<MidiPortSender>(std::shared_ptr<RtMidiOut>(), m_pStats, m_hostClock);
+    }
+    pPorts->ports.push_back({ name, sender });
+    m_ports.Publish(std::move(pPorts));
+    return;
+  }
+  if (m_pSequencer) {
+    // One sender for the sequencer, it fans out to every connected port
+    const int connected = m_pSequencer->ConnectOutputs();
+    std::cout << "MIDI sequencer connected to " << connected << " port(s)" << std::endl;
+    const std::string name = "sequencer";
+    auto sender = takeHealthy(name);
+    if (!sender) {
+      sender = std::make_shared<MidiPortSender>(m_pSequencer, m_pStats, m_hostClock);
+    }
+    pPorts->ports.push_back({ name, sender });
+    m_ports.Publish(std::move(pPorts));
+    return;
+  }
+  // Add all available ports, excluding port 0 (internal software port)
+  if (nPorts != 1) { std::cout << "Found " << nPorts << " MIDI port(s)" << std::endl; }
+  auto names = std::unique_ptr<RtMidiOut>(new RtMidiOut());
   for (unsigned int i = 1; i < nPorts; i++) {
-    auto port = std::shared_ptr<RtMidiOut>(new RtMidiOut());
-    m_ports.push_back(port);
+    std::string name;
     try {
-      std::cout << "Trying to open port " << i << ", " << port->getPortName(i) << std::endl;
-      port->openPort(i);
-      std::cout << "Port Ready" << std::endl;
+      name = names->getPortName(i);
     } catch (RtMidiError &error) {
       error.printMessage();
+      continue;
+    }
+    auto sender = takeHealthy(name);
+    if (!sender) {
+      auto port = std::shared_ptr<RtMidiOut>(new RtMidiOut());
+      try {
+        std::cout << "Trying to open port " << i << ", " << name << std::endl;
+        port->openPort(i);
+        std::cout << "Port Ready" << std::endl;
+      } catch (RtMidiError &error) {
+        error.printMessage();
+        continue;
+      }
+      sender = std::make_shared<MidiPortSender>(port, m_pStats, m_hostClock);
     }
+    pPorts->ports.push_back({ name, sender });
   }
-  m_block_midi = false;
+  m_ports.Publish(std::move(pPorts));
   if (nPorts == 1) {
     //If there's only 1 port available, that's a software port, not hardware
     std::cout << "No External MIDI ports available!" << std::endl;
@@ -128,13 +191,6 @@ void MidiOut::init_ports() {
 }
 
 void MidiOut::close_ports() {
-  for(auto & port : m_ports) {
-  /* std::cout << *it; ... */
-    try {
-      port->closePort();
-    } catch (RtMidiError &error) {
-      error.printMessage();
-    }
-  }
-  m_ports.clear();
+  // Each sender stops its thread and then closes its port
+  m_ports.Publish(std::unique_ptr<PortSet>(new PortSet()));
 }
@@ -3,7 +3,13 @@
 #include <memory>
 #include <chrono>
 #include <atomic>
+#include <string>
+#include <vector>
 #include <rtmidi/RtMidi.h>
+#include "missing_link/midi_sender.hpp"
+#include "missing_link/output_stats.hpp"
+#include "missing_link/rcu_pointer.hpp"
+#include "missing_link/alsa_sequencer.hpp"
 
 namespace MissingLink {
 
@@ -11,25 +17,59 @@ class MidiOut {
 
   public:
 
-    MidiOut();
+    // useSequencer schedules MIDI clock through an ALSA sequencer queue,
+    // falling back to RtMidi if the sequencer can't be opened
+    MidiOut(std::shared_ptr<OutputStats> pStats, HostClock hostClock, bool useSequencer);
     virtual ~MidiOut();
 
-    void ClockOut();
-    void StartTransport();
-    void StopTransport();
+    // Realtime safe: these only queue the message for each port's sender
+    // thread. time is the host time the message belongs to.
+    // Output thread only, each sender queue has a single producer.
+    void ClockOut(std::chrono::microseconds time);
+    void StartTransport(std::chrono::microseconds time);
+    void StopTransport(std::chrono::microseconds time);
     void AllNotesOff();
+
+    // Reopens the ports on hotplug, or when a port failed
     void CheckPorts();
 
+    // True if MIDI clock can be handed to the kernel ahead of time with
+    // ScheduleClock() instead of sent with ClockOut() when it is due
+    bool SchedulesClock() const { return m_pSequencer != nullptr; }
+
+    // Edge planner thread only. Delivered by the kernel at the given host time.
+    void ScheduleClock(std::chrono::microseconds time);
+
+    // Edge planner thread only. Drops clocks scheduled against an old timeline.
+    void CancelScheduledClock();
+
   protected:
 
-    std::vector<unsigned char> m_message;
+    // Immutable once published. Hotplug builds a new set and swaps it in,
+    // carrying the senders of ports that are still there and working over
+    // with whatever they have queued.
+    struct PortSet {
+      struct Port {
+        std::string name;
+        std::shared_ptr<MidiPortSender> sender;
+      };
+      std::vector<Port> ports; //one per open hardware port, port 0 (internal software port) is skipped
+    };
+
     unsigned int m_numPorts;
 
-    std::atomic<bool> m_block_midi;
+    // Messages go to the simulator's MIDI sink instead of ALSA
+    const bool m_simulated;
+
+    std::shared_ptr<OutputStats> m_pStats;
+    HostClock m_hostClock;
+
+    std::shared_ptr<AlsaSequencer> m_pSequencer;
 
-    std::vector<std::shared_ptr<RtMidiOut>> m_ports; //repository for all the known hardware ports, port 0 is internal software port
+    RcuPointer<PortSet> m_ports;
 
     unsigned int CountPorts();
+    void send(std::chrono::microseconds time, unsigned char status);
     void init_ports();
     void close_ports();
 
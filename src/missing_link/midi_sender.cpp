@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <iostream>
+#include <pthread.h>
+#include "missing_link/simulator.hpp"
+#include "missing_link/alsa_sequencer.hpp"
+#include "missing_link/midi_sender.hpp"
+
+using namespace MissingLink;
+
+namespace MissingLink {
+
+  // Longest a sender sleeps without being woken, so it notices Stop()
+  static const std::chrono::milliseconds SenderIdleWait(100);
+
+}
+
+MidiPortSender::MidiPortSender(std::shared_ptr<RtMidiOut> pPort, std::shared_ptr<OutputStats> pStats,
+    HostClock hostClock)
+  : m_pPort(pPort)
+  , m_pStats(pStats)
+  , m_hostClock(hostClock)
+  , m_message(1)
+  , m_failed(false)
+  , m_stopped(false)
+{
+  start();
+}
+
+MidiPortSender::MidiPortSender(std::shared_ptr<AlsaSequencer> pSequencer, std::shared_ptr<OutputStats> pStats,
+    HostClock hostClock)
+  : m_pSequencer(pSequencer)
+  , m_pStats(pStats)
+  , m_hostClock(hostClock)
+  , m_message(1)
+  , m_failed(false)
+  , m_stopped(false)
+{
+  start();
+}
+
+void MidiPortSender::start() {
+  m_pThread = std::unique_ptr<std::thread>(new std::thread(&MidiPortSender::run, this));
+
+  // Below the output thread, above the edge planner
+  sched_param param;
+  param.sched_priority = 80;
+  if(::pthread_setschedparam(m_pThread->native_handle(), SCHED_FIFO, &param) < 0) {
+    std::cerr << "Failed to set MIDI sender thread priority\n";
+  }
+}
+
+MidiPortSender::~MidiPortSender() {
+  m_stopped = true;
+  m_timer.Wake();
+  if (m_pThread && m_pThread->joinable()) {
+    m_pThread->join();
+  }
+  if (m_pPort) {
+    try {
+      m_pPort->closePort();
+    } catch (RtMidiError &error) {
+      error.printMessage();
+    }
+  }
+}
+
+bool MidiPortSender::Send(const MidiEvent &event) {
+  if (!m_queue.Push(event)) {
+    return false;
+  }
+  m_timer.Wake();
+  return true;
+}
+
+void MidiPortSender::run() {
+  while (!m_stopped) {
+    MidiEvent event;
+    while (m_queue.Pop(event)) {
+      send(event);
+    }
+    if (m_timer.IsValid()) {
+      m_timer.WaitUntil(DeadlineTimer::Now() + SenderIdleWait);
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+}
+
+void MidiPortSender::send(const MidiEvent &event) {
+  if (m_failed) {
+    return;
+  }
+
+  m_message[0] = event.status;
+  if (m_pSequencer) {
+    if (!m_pSequencer->SendNow(event.status)) {
+      m_failed = true;
+      return;
+    }
+  } else if (m_pPort) {
+    try {
+      m_pPort->sendMessage(&m_message);
+    } catch (RtMidiError &error) {
+      // MidiOut::CheckPorts() reopens the ports once it sees this
+      error.printMessage();
+      m_failed = true;
+      return;
+    }
+  } else {
+    Simulator::Get().SendMidi(m_message);
+  }
+
+  if (event.status == 0xF8) {
+    m_pStats->midiClockLatency.Record(m_hostClock() - event.time);
+  }
+}
@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <rtmidi/RtMidi.h>
+#include "missing_link/deadline_timer.hpp"
+#include "missing_link/host_clock.hpp"
+#include "missing_link/spsc_queue.hpp"
+#include "missing_link/output_stats.hpp"
+
+namespace MissingLink {
+
+  /// A single byte MIDI realtime message
+  struct MidiEvent {
+    std::chrono::microseconds time;   // host time the message belongs to
+    unsigned char status;
+  };
+
+  typedef SPSCQueue<MidiEvent, 128> MidiEventQueue;
+
+  class AlsaSequencer;
+
+  // Sends to one MIDI port from its own thread, so a slow or failing
+  // interface never holds up the output thread or the other ports.
+  class MidiPortSender {
+
+    public:
+
+      // A null port sends to the simulator's MIDI sink
+      MidiPortSender(std::shared_ptr<RtMidiOut> pPort, std::shared_ptr<OutputStats> pStats,
+          HostClock hostClock);
+
+      // Sends through the sequencer, to every port it is connected to
+      MidiPortSender(std::shared_ptr<AlsaSequencer> pSequencer, std::shared_ptr<OutputStats> pStats,
+          HostClock hostClock);
+      virtual ~MidiPortSender();
+
+      // Output thread only, never blocks. Returns false if the queue is full.
+      bool Send(const MidiEvent &event);
+
+      // Set once the port returned an error. Nothing is sent after that.
+      bool HasFailed() const { return m_failed.load(); }
+
+    private:
+
+      void start();
+      void run();
+      void send(const MidiEvent &event);
+
+      std::shared_ptr<RtMidiOut> m_pPort;
+      std::shared_ptr<AlsaSequencer> m_pSequencer;
+      std::shared_ptr<OutputStats> m_pStats;
+      HostClock m_hostClock;
+
+      MidiEventQueue m_queue;
+      DeadlineTimer m_timer;
+      std::vector<unsigned char> m_message;
+
+      std::atomic<bool> m_failed;
+      std::atomic<bool> m_stopped;
+      std::unique_ptr<std::thread> m_pThread;
+  };
+
+}
@@ -22,13 +22,61 @@ using namespace MissingLink::GPIO;
 using std::min;
 using std::max;
 
-OutputProcess::OutputProcess(Engine &engine)
+namespace MissingLink {
+
+  // Upper bound on a single sleep of the output thread
+  static const std::chrono::microseconds MaxEdgeWait(20000);
+
+  // Sleep until this long before an edge, then spin the rest of the way
+  static const std::chrono::microseconds EdgeSpinTime(100);
+
+  // How far ahead of now edges are planned
+  static const std::chrono::microseconds EdgeLookahead(20000);
+
+  // Planner wakeup interval, well inside the lookahead
+  static const std::chrono::microseconds PlannerInterval(5000);
+
+  // Re-plan if an already queued edge moved by more than this
+  static const std::chrono::microseconds MaxTimelineDrift(100);
+
+  // Edges closer together than this (in beats) are fired together
+  static const double SimultaneousBeats = 1.0e-9;
+
+  // Edges fired later than this are counted as missed
+  static const std::chrono::microseconds MissedEdgeLateness(1000);
+
+  static const long long MidiPPQN = 24;
+
+  static long long positiveMod(long long value, long long divisor) {
+    long long result = value % divisor;
+    return result < 0 ? result + divisor : result;
+  }
+
+}
+
+OutputProcess::OutputProcess(Engine &engine, std::shared_ptr<EdgeQueue> pEdgeQueue,
+    std::shared_ptr<OutputStats> pStats, std::shared_ptr<IOExpander> pExpander)
   : Engine::Process(engine, std::chrono::microseconds(500))
+  , m_pEdgeQueue(pEdgeQueue)
+  , m_pStats(pStats)
   , m_pClockOut(std::unique_ptr<Pin>(new Pin(ML_CLOCK_PIN, Pin::OUT)))
   , m_pResetOut(std::unique_ptr<Pin>(new Pin(ML_RESET_PIN, Pin::OUT)))
+  , m_pExpander(pExpander)
 {
+  m_pExpander->SetOutputPriority(I2CBus::Priority::Clock);
+
+  std::vector<PulseEvent> pulseStorage;
+  pulseStorage.reserve(2 * NUM_LINES);
+  m_pulseQueue = PulseQueue(PulseEventLater(), std::move(pulseStorage));
+
+  for (int i = 0; i < ML_NUM_CLOCK_CHANNELS; i++) {
+    m_channelTicksPerBeat[i] = 1.0;
+    m_channelMinGap[i] = 1.0;
+  }
+
   m_pClockOut->Write(LOW);
   m_pResetOut->Write(LOW);
+  m_pExpander->WriteOutput(0x00);
 }
 
 void OutputProcess::Run() {
@@ -40,98 +88,245 @@ void OutputProcess::Run() {
   }
 }
 
+void OutputProcess::Notify() {
+  m_timer.Wake();
+}
+
+void OutputProcess::run() {
+  while (IsRunning()) {
+    process();
+    waitForNextEdge();
+  }
+}
+
+void OutputProcess::waitForNextEdge() {
+  // Fall back to fixed interval polling if there is no timer
+  if (!m_timer.IsValid()) {
+    sleep();
+    return;
+  }
+
+  const auto now = m_engine.GetHostTime();
+  auto deadline = now + MaxEdgeWait;
+  if (const EdgeEvent *pNext = m_pEdgeQueue->Peek()) {
+    deadline = min(deadline, pNext->time);
+  }
+  if (!m_pulseQueue.empty()) {
+    deadline = min(deadline, m_pulseQueue.top().time);
+  }
+
+  const auto wakeTime = deadline - EdgeSpinTime;
+  if (wakeTime > now) {
+    // Host time and CLOCK_MONOTONIC tick at the same rate, so offset the
+    // remaining interval from the current monotonic time
+    if (m_timer.WaitUntil(DeadlineTimer::Now() + (wakeTime - now))) {
+      // New edges or state change, re-evaluate right away
+      return;
+    }
+  }
+
+  while (IsRunning() && m_engine.GetHostTime() < deadline) {
+    // spin
+  }
+}
+
 void OutputProcess::process() {
+  const auto now = m_engine.GetHostTime();
+  refreshSettings();
+
+  // Pulse ends first, in case one falls on the same tick as a new pulse
+  firePulseEvents(now);
+
+  // Fire everything that is due, dropping edges planned against a stale timeline
+  const unsigned int generation = m_engine.GetScheduleGeneration();
+  EdgeEvent event;
+  while (const EdgeEvent *pNext = m_pEdgeQueue->Peek()) {
+    if (pNext->generation == generation && pNext->time > now) {
+      break;
+    }
+    m_pEdgeQueue->Pop(event);
+    if (event.generation == generation) {
+      if (now - event.time > MissedEdgeLateness) {
+        m_pStats->missedEdges++;
+      }
+      fireEdge(event);
+    }
+  }
+
+  if (m_engine.GetPlayState() == Engine::PlayState::Stopped) {
+    stopOutputs();
+  }
+
+  // All channel changes of this pass go out together
+  writeChannels();
+  recordClockLatency();
+
+  // Took so long that the next edge is already late
+  if (const EdgeEvent *pNext = m_pEdgeQueue->Peek()) {
+    if (pNext->generation == generation && pNext->time <= m_engine.GetHostTime()) {
+      m_pStats->loopOverruns++;
+    }
+  }
+}
+
+void OutputProcess::fireEdge(const EdgeEvent &event) {
   auto midiOut = m_engine.GetMidiOut();
-  auto playState = m_engine.GetPlayState();
-  const auto model = m_engine.GetOutputModel(m_lastOutTime);
-  m_lastOutTime = model.now;
+  const bool resetTriggered = event.reset;
 
-  switch (playState) {
+  switch (m_engine.GetPlayState()) {
     case Engine::PlayState::Stopped:
-      if (m_transportStopped == false) {
-        midiOut->StopTransport();
-        m_transportStopped = true;
-      }
-      setClock(false);
-      setReset(false);
+      stopOutputs();
       break;
     case Engine::PlayState::Cued:
       // start playing on first clock of loop
-      if (!model.resetTriggered) {
+      if (!resetTriggered) {
         break;
       }
       // Deliberate fallthrough here
       m_engine.SetPlayState(Engine::PlayState::Playing);
     case Engine::PlayState::Playing:
-      triggerOutputs(model.clockTriggered, model.resetTriggered);
+      triggerOutputs(event);
       break;
     case Engine::PlayState::CuedStop:
       // stop playing on first clock of loop
-      if (model.resetTriggered) {
+      if (resetTriggered) {
         m_engine.SetPlayState(Engine::PlayState::Stopped);
-        midiOut->StopTransport(); //stop before start of next loop
+        midiOut->StopTransport(event.time); //stop before start of next loop
         m_transportStopped = true;
       } else {
         //keep playing the clock
-        triggerOutputs(model.clockTriggered, model.resetTriggered);
+        triggerOutputs(event);
       }
       break;
     default:
       break;
   }
-  if (model.midiClockTriggered) { midiOut->ClockOut(); } //always output midi clock
+  if (event.midiByte == 0xF8) { midiOut->ClockOut(event.time); } //always output midi clock
+}
+
+void OutputProcess::refreshSettings() {
+  if (m_engine.GetSettingsGeneration() == m_settingsGeneration) {
+    return;
+  }
+  m_settingsGeneration = m_engine.GetSettings(m_settings);
+  for (int i = 0; i < ML_NUM_CLOCK_CHANNELS; i++) {
+    const ClockChannel &channel = m_settings.channels[i];
+    m_channelTicksPerBeat[i] = channel.getTicksPerBeat(m_settings.getPPQN());
+    m_channelMinGap[i] = (1.0 - channel.getSwingDelay()) / m_channelTicksPerBeat[i];
+  }
 }
 
-void OutputProcess::triggerOutputs(bool clockTriggered, bool resetTriggered) {
+void OutputProcess::stopOutputs() {
+  if (m_transportStopped == false) {
+    m_engine.GetMidiOut()->StopTransport(m_engine.GetHostTime());
+    m_transportStopped = true;
+  }
+  clearPulseEvents();
+  m_channelState = 0;
+  setReset(false);
+}
+
+void OutputProcess::triggerOutputs(const EdgeEvent &event) {
+  const uint8_t channels = event.channels;
+  const bool resetTriggered = event.reset;
   auto midiOut = m_engine.GetMidiOut();
   auto playState = m_engine.GetPlayState();
   auto mainView = m_engine.GetMainView();
+  const Settings &settings = m_settings;
   bool resetTrig = true;
-  if (m_engine.getResetMode() == 2) {
+  if (settings.reset_mode == 2) {
     resetTrig = false;
   }
   if (resetTriggered) {
     setReset(resetTrig);
+    m_pStats->resetLatency.Record(m_engine.GetHostTime() - event.time);
     //first reset trigger is start of sequence, tell midi to StartTransport
     //or, a manually queued MIDI Start Transport
     if (m_transportStopped || m_engine.GetQueuedStartTransport()) {
-      midiOut->StartTransport();
+      midiOut->StartTransport(event.time);
       mainView->flashLedRing();
       m_transportStopped = false;
     }
   }
-  if (clockTriggered) { setClock(true); }
 
-  if (clockTriggered || resetTriggered) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(5));
-    switch (m_engine.getResetMode()) {
+  const auto now = m_engine.GetHostTime();
+  const double usPerBeat = 60.0e6 / event.tempo;
+
+  if (channels != 0) {
+    // Measured once the pass writes the channels
+    if (m_pendingClockEdges == 0 || event.time < m_pendingClockTime) {
+      m_pendingClockTime = event.time;
+    }
+    m_pendingClockEdges++;
+    m_pendingClockChannels |= channels;
+  }
+
+  for (int i = 0; i < ML_NUM_CLOCK_CHANNELS; i++) {
+    if ((channels & (1 << i)) == 0) { continue; }
+    const auto tickPeriod = std::chrono::microseconds((long long)(usPerBeat / m_channelTicksPerBeat[i]));
+    const auto minGap = std::chrono::microseconds((long long)(usPerBeat * m_channelMinGap[i]));
+    const auto width = min(settings.channels[i].pulse.getDuration(tickPeriod), minGap * 9 / 10);
+    setLine(i, true);
+    schedulePulseEnd(i, false, now + width);
+  }
+
+  // The reset pulse is timed from the reset edge alone. Ending it again on
+  // every channel tick would keep pushing its end out, and hold the line
+  // for good once a channel ticks faster than the pulse is wide.
+  if (resetTriggered) {
+    const auto tickPeriod = std::chrono::microseconds((long long)(usPerBeat / (double)settings.getPPQN()));
+    const auto resetEnd = now + settings.reset_pulse.getDuration(tickPeriod);
+    switch (settings.reset_mode) {
       case 0:
         if (playState == Engine::PlayState::Playing) {
-          setReset(false);
+          schedulePulseEnd(RESET_LINE, false, resetEnd);
         }
         break;
       case 1:
         if (playState == Engine::PlayState::Playing) {
-          setReset(true);
+          schedulePulseEnd(RESET_LINE, true, resetEnd);
         }
         break;
       case 2:
         if (playState == Engine::PlayState::Playing) {
-          setReset(true);
+          schedulePulseEnd(RESET_LINE, true, resetEnd);
         }
         break;
       default:
-        setReset(false);
+        schedulePulseEnd(RESET_LINE, false, resetEnd);
         break;
     }
-    setClock(false);
   }
 }
 
-void OutputProcess::setClock(bool high) {
-  if (m_clockHigh == high) { return; }
-  m_clockHigh = high;
-  m_pClockOut->Write(high ? HIGH : LOW);
+void OutputProcess::schedulePulseEnd(int line, bool high, std::chrono::microseconds time) {
+  m_pulseQueue.push({ time, line, high, ++m_pulseSequence[line] });
+}
+
+void OutputProcess::firePulseEvents(std::chrono::microseconds now) {
+  while (!m_pulseQueue.empty() && m_pulseQueue.top().time <= now) {
+    const PulseEvent event = m_pulseQueue.top();
+    m_pulseQueue.pop();
+    if (event.sequence == m_pulseSequence[event.line]) {
+      setLine(event.line, event.high);
+    }
+  }
+}
+
+void OutputProcess::clearPulseEvents() {
+  while (!m_pulseQueue.empty()) {
+    m_pulseQueue.pop();
+  }
+}
+
+void OutputProcess::setLine(int line, bool high) {
+  if (line == RESET_LINE) {
+    setReset(high);
+  } else if (high) {
+    m_channelState |= (1 << line);
+  } else {
+    m_channelState &= ~(1 << line);
+  }
 }
 
 void OutputProcess::setReset(bool high) {
@@ -140,70 +335,301 @@ void OutputProcess::setReset(bool high) {
   m_pResetOut->Write(high ? HIGH : LOW);
 }
 
+void OutputProcess::writeChannels() {
+  const uint8_t changed = m_channelState ^ m_writtenChannelState;
+  if (changed == 0) { return; }
+
+  // Channel 0 is on a GPIO, the fast path
+  if (changed & 0x01) {
+    m_pClockOut->Write((m_channelState & 0x01) ? HIGH : LOW);
+    if (m_pendingClockChannels & 0x01) {
+      m_pStats->clockLatency.Record(m_engine.GetHostTime() - m_pendingClockTime);
+    }
+  }
+
+  // The others share the expander output latch, one I2C write for all of
+  // them. It may wait for a display batch already on the bus, so these
+  // edges are measured on their own.
+  if (changed & ~0x01) {
+    m_pExpander->WriteOutput((m_channelState & ~0x01) << (ML_EXPANDER_CLOCK_PIN - 1));
+    if (m_pendingClockChannels & ~0x01) {
+      m_pStats->expanderClockLatency.Record(m_engine.GetHostTime() - m_pendingClockTime);
+    }
+  }
+
+  m_writtenChannelState = m_channelState;
+}
+
+void OutputProcess::recordClockLatency() {
+  if (m_pendingClockEdges == 0) { return; }
+  // Latency was taken when the channels were written, from the earliest
+  // edge of the pass. The later ones rode along with it.
+  m_pStats->mergedEdges += m_pendingClockEdges - 1;
+  m_pendingClockEdges = 0;
+  m_pendingClockChannels = 0;
+}
+
+EdgePlannerProcess::EdgePlannerProcess(Engine &engine, std::shared_ptr<EdgeQueue> pEdgeQueue)
+  : Engine::Process(engine, PlannerInterval)
+  , m_pEdgeQueue(pEdgeQueue)
+{}
+
+void EdgePlannerProcess::Run() {
+  Process::Run();
+  sched_param param;
+  param.sched_priority = 70;
+  if(::pthread_setschedparam(m_pThread->native_handle(), SCHED_FIFO, &param) < 0) {
+    std::cerr << "Failed to set edge planner thread priority\n";
+  }
+}
+
+void EdgePlannerProcess::Notify() {
+  m_timer.Wake();
+}
+
+void EdgePlannerProcess::run() {
+  while (IsRunning()) {
+    process();
+    if (m_timer.IsValid()) {
+      m_timer.WaitUntil(DeadlineTimer::Now() + PlannerInterval);
+    } else {
+      sleep();
+    }
+  }
+}
+
+void EdgePlannerProcess::process() {
+  const auto now = m_engine.GetHostTime();
+  const unsigned int generation = m_engine.GetScheduleGeneration();
+  refreshSettings();
+  const auto timeline = m_engine.CaptureAudioSessionState();
+
+  const auto delay = m_delay;
+  const double quantum = (double)m_settings.quantum;
+
+  auto midiOut = m_engine.GetMidiOut();
+  const bool scheduleMidi = midiOut->SchedulesClock();
+
+  if (!m_planning || generation != m_generation) {
+    // Start over from the next edges after now
+    if (scheduleMidi) { midiOut->CancelScheduledClock(); }
+    restart(timeline.beatAtTime(now - delay, quantum));
+    m_generation = generation;
+  } else if (m_hasPlanned) {
+    // Catch timeline moves that arrive without a callback, e.g. on joining a session
+    const auto expected = timeline.timeAtBeat(m_lastPlannedBeat, quantum) + delay;
+    const auto drift = expected - m_lastPlannedTime;
+    if (drift > MaxTimelineDrift || drift < -MaxTimelineDrift) {
+      m_engine.InvalidateSchedule();
+      return;
+    }
+  }
+
+  const double tempo = timeline.tempo();
+  const auto horizon = now + EdgeLookahead;
+  bool planned = false;
+
+  while (true) {
+    // Earliest of MIDI clock, loop start and every channel's next tick
+    const double midiBeat = (double)m_nextMidiTick / (double)MidiPPQN;
+    const double loopBeat = (double)m_nextLoop * quantum;
+    double beat = min(midiBeat, loopBeat);
+    for (const auto &channel : m_channels) {
+      if (channel.enabled) {
+        beat = min(beat, tickBeat(channel, channel.nextTick));
+      }
+    }
+
+    const auto time = timeline.timeAtBeat(beat, quantum) + delay;
+    if (time > horizon) {
+      break;
+    }
+
+    // Batch everything that lands on this beat into one event
+    EdgeEvent event;
+    event.time = time;
+    event.tempo = tempo;
+    event.channels = 0;
+    event.reset = (loopBeat - beat) < SimultaneousBeats;
+    event.midiByte = (midiBeat - beat) < SimultaneousBeats ? 0xF8 : 0;
+    event.generation = generation;
+    for (int i = 0; i < ML_NUM_CLOCK_CHANNELS; i++) {
+      const auto &channel = m_channels[i];
+      if (channel.enabled && (tickBeat(channel, channel.nextTick) - beat) < SimultaneousBeats) {
+        event.channels |= (1 << i);
+      }
+    }
+
+    // MIDI clock goes straight to the kernel, except on a loop start: the
+    // output thread may send a start first there and must keep the order
+    const bool midiTick = event.midiByte != 0;
+    const bool midiScheduled = scheduleMidi && midiTick && !event.reset;
+    if (midiScheduled) {
+      event.midiByte = 0;
+    }
+
+    if ((event.channels != 0 || event.reset || event.midiByte != 0) && !m_pEdgeQueue->Push(event)) {
+      break;
+    }
+    if (midiScheduled) {
+      midiOut->ScheduleClock(time);
+    }
+
+    if (event.reset) { m_nextLoop++; }
+    if (midiTick) { m_nextMidiTick++; }
+    for (int i = 0; i < ML_NUM_CLOCK_CHANNELS; i++) {
+      if (event.channels & (1 << i)) {
+        advance(m_channels[i]);
+      }
+    }
+
+    m_lastPlannedBeat = beat;
+    m_lastPlannedTime = time;
+    m_hasPlanned = true;
+    planned = true;
+  }
+
+  if (planned && onEdgesPlanned) {
+    onEdgesPlanned();
+  }
+}
+
+void EdgePlannerProcess::refreshSettings() {
+  if (m_engine.GetSettingsGeneration() == m_settingsGeneration) {
+    return;
+  }
+  m_settingsGeneration = m_engine.GetSettings(m_settings);
+  m_delay = std::chrono::milliseconds(m_settings.delay_compensation);
+
+  for (int i = 0; i < ML_NUM_CLOCK_CHANNELS; i++) {
+    const ClockChannel &config = m_settings.channels[i];
+    ChannelPlan &channel = m_channels[i];
+    channel.ticksPerBeat = config.getTicksPerBeat(m_settings.getPPQN());
+    channel.phase = std::min(99, std::max(0, config.phase)) / 100.0;
+    channel.swing = config.getSwingDelay();
+    channel.euclidSteps = std::max(0, config.euclid_steps);
+    channel.euclidPulses = std::min(channel.euclidSteps, std::max(0, config.euclid_pulses));
+    channel.euclidRotation = config.euclid_rotation;
+    // An empty Euclidean pattern never fires
+    channel.enabled = config.enabled && (channel.euclidSteps == 0 || channel.euclidPulses > 0);
+  }
+
+  // Channel rates may have changed, the tick cursors need recomputing
+  m_planning = false;
+}
+
+void EdgePlannerProcess::restart(double beats) {
+  m_nextMidiTick = (long long)floor(beats * (double)MidiPPQN) + 1;
+  m_nextLoop = (long long)floor(beats / (double)m_settings.quantum) + 1;
+
+  for (auto &channel : m_channels) {
+    if (!channel.enabled) { continue; }
+    // Swing and phase shift a tick by less than two ticks, so start just
+    // behind and walk forward to the first firing tick after now
+    channel.nextTick = (long long)floor(beats * channel.ticksPerBeat) - 2;
+    while (tickBeat(channel, channel.nextTick) <= beats || !tickFires(channel, channel.nextTick)) {
+      channel.nextTick++;
+    }
+  }
+
+  m_planning = true;
+  m_hasPlanned = false;
+}
+
+double EdgePlannerProcess::tickBeat(const ChannelPlan &channel, long long tick) {
+  double shift = channel.phase;
+  if (positiveMod(tick, 2) == 1) {
+    shift += channel.swing;
+  }
+  return ((double)tick + shift) / channel.ticksPerBeat;
+}
+
+bool EdgePlannerProcess::tickFires(const ChannelPlan &channel, long long tick) {
+  if (channel.euclidSteps == 0) {
+    return true;
+  }
+  // Bresenham style Euclidean rhythm: pulses spread as evenly as possible over the steps
+  const long long step = positiveMod(tick + channel.euclidRotation, channel.euclidSteps);
+  return (step * channel.euclidPulses) % channel.euclidSteps < channel.euclidPulses;
+}
+
+void EdgePlannerProcess::advance(ChannelPlan &channel) {
+  do {
+    channel.nextTick++;
+  } while (!tickFires(channel, channel.nextTick));
+}
+
 namespace MissingLink {
 
-  static const int NUM_ANIM_FRAMES = 6;
+  // LED ring animations over the phase of the quantum, one keyframe per
+  // LED. Levels are perceived brightness, see GammaCorrect().
+  typedef Keyframe<MainView::NumAnimLEDs> RingKeyframe;
 
-  static const float CueAnimationFrames[][6] =  {
-    {0.2, 0, 0, 0.1, 0.2, 0.3},
-    {0.2, 0.2, 0, 0, 0.1, 0.2},
-    {0.2, 0.2, 0.2, 0, 0, 0.1},
-    {0.2, 0.2, 0.2, 0.2, 0, 0},
-    {0.2, 0.2, 0.2, 0.2, 0.2, 0},
-    {0.2, 0.2, 0.2, 0.2, 0.2, 0.2},
+  // Filling up towards the start
+  static constexpr RingKeyframe CueKeyframes[] = {
+    {0.0f / 6, {0.48, 0, 0, 0.35, 0.48, 0.58}},
+    {1.0f / 6, {0.48, 0.48, 0, 0, 0.35, 0.48}},
+    {2.0f / 6, {0.48, 0.48, 0.48, 0, 0, 0.35}},
+    {3.0f / 6, {0.48, 0.48, 0.48, 0.48, 0, 0}},
+    {4.0f / 6, {0.48, 0.48, 0.48, 0.48, 0.48, 0}},
+    {5.0f / 6, {0.48, 0.48, 0.48, 0.48, 0.48, 0.48}},
+    {1.0f,     {0.48, 0.48, 0.48, 0.48, 0.48, 0.48}},
   };
 
-  static const float PlayAnimationFrames[][6] = {
-    {1, 0.1, 0.1, 0.1, 0.1, 0.1},
-    {0.1, 1, 0.1, 0.1, 0.1, 0.1},
-    {0.1, 0.1, 1, 0.1, 0.1, 0.1},
-    {0.1, 0.1, 0.1, 1, 0.1, 0.1},
-    {0.1, 0.1, 0.1, 0.1, 1, 0.1},
-    {0.1, 0.1, 0.1, 0.1, 0.1, 1},
+  // One bright LED going round
+  static constexpr RingKeyframe PlayKeyframes[] = {
+    {0.0f / 6, {1, 0.35, 0.35, 0.35, 0.35, 0.35}},
+    {1.0f / 6, {0.35, 1, 0.35, 0.35, 0.35, 0.35}},
+    {2.0f / 6, {0.35, 0.35, 1, 0.35, 0.35, 0.35}},
+    {3.0f / 6, {0.35, 0.35, 0.35, 1, 0.35, 0.35}},
+    {4.0f / 6, {0.35, 0.35, 0.35, 0.35, 1, 0.35}},
+    {5.0f / 6, {0.35, 0.35, 0.35, 0.35, 0.35, 1}},
+    {1.0f,     {1, 0.35, 0.35, 0.35, 0.35, 0.35}},
   };
 
-  static const float CuedStopAnimationFrames[][6] = {
-    {0, 0.1, 0.2, 0.3, 0.4, 0.5},
-    {0, 0.03, 0.1, 0.2, 0.3, 0.4},
-    {0, 0, 0.03, 0.1, 0.2, 0.3},
-    {0, 0, 0, 0.03, 0.1, 0.2},
-    {0, 0, 0, 0, 0.03, 0.1},
-    {0.01, 0, 0, 0, 0, 0},
+  // Draining towards the stop
+  static constexpr RingKeyframe CuedStopKeyframes[] = {
+    {0.0f / 6, {0, 0.35, 0.48, 0.58, 0.66, 0.73}},
+    {1.0f / 6, {0, 0.2, 0.35, 0.48, 0.58, 0.66}},
+    {2.0f / 6, {0, 0, 0.2, 0.35, 0.48, 0.58}},
+    {3.0f / 6, {0, 0, 0, 0.2, 0.35, 0.48}},
+    {4.0f / 6, {0, 0, 0, 0, 0.2, 0.35}},
+    {5.0f / 6, {0.12, 0, 0, 0, 0, 0}},
+    {1.0f,     {0.12, 0, 0, 0, 0, 0}},
   };
 
-  static const float StoppedAnimationFrames[][6] = {
-    {0.05, 0, 0, 0.02, 0.02, 0.03},
-    {0.03, 0.05, 0, 0, 0.02, 0.02},
-    {0.02, 0.03, 0.05, 0, 0, 0.02},
-    {0.02, 0.02, 0.03, 0.05, 0, 0},
-    {0, 0.02, 0.02, 0.03, 0.05, 0},
-    {0, 0, 0.02, 0.02, 0.03, 0.05},
+  // Faint tail going round while stopped with peers
+  static constexpr RingKeyframe StoppedKeyframes[] = {
+    {0.0f / 6, {0.26, 0, 0, 0.17, 0.17, 0.2}},
+    {1.0f / 6, {0.2, 0.26, 0, 0, 0.17, 0.17}},
+    {2.0f / 6, {0.17, 0.2, 0.26, 0, 0, 0.17}},
+    {3.0f / 6, {0.17, 0.17, 0.2, 0.26, 0, 0}},
+    {4.0f / 6, {0, 0.17, 0.17, 0.2, 0.26, 0}},
+    {5.0f / 6, {0, 0, 0.17, 0.17, 0.2, 0.26}},
+    {1.0f,     {0.26, 0, 0, 0.17, 0.17, 0.2}},
   };
 
+  // Wi-Fi LED animations, positions in seconds
+
   //Animation for WIFI LED when AP is ready to connect to
-  static std::vector<float> WifiAccessPointReady =
-    {
-      0, 0.05, 0.1, 0.15, 0.2, 0.25, 0.3, 0.35, 0.4, 0.45, 0.5, 0.55,
-      0.6, 0.65, 0.7, 0.75, 0.8, 0.85, 0.9, 0.95, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,
-      0.95, 0.9, 0.85, 0.8, 0.75, 0.7, 0.65, 0.6, 0.55, 0.5, 0.45, 0.4,
-      0.35, 0.3, 0.25, 0.2, 0.15, 0.1, 0.05, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-    };
+  static constexpr Keyframe<1> WifiAccessPointReadyKeyframes[] = {
+    {0.0f, {0}},
+    {0.3f, {1}},
+    {0.375f, {1}},
+    {0.675f, {0}},
+    {0.825f, {0}},
+  };
 
   //Animation for WIFI LED when failed to connect to known AP, booting AP mode
-  static std::vector<float> WifiTryingToConnect =
-  {
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  static constexpr Keyframe<1> WifiTryingToConnectKeyframes[] = {
+    {0.0f, {0}},
+    {0.225f, {0}}, {0.225f, {1}},
+    {0.375f, {1}}, {0.375f, {0}},
+    {0.6f, {0}}, {0.6f, {1}},
+    {0.75f, {1}}, {0.75f, {0}},
+    {0.975f, {0}}, {0.975f, {1}},
+    {1.125f, {1}}, {1.125f, {0}},
+    {2.475f, {0}},
   };
 
 }
@@ -211,6 +637,13 @@ namespace MissingLink {
 ViewUpdateProcess::ViewUpdateProcess(Engine &engine, std::shared_ptr<MainView> pView)
   : Engine::Process(engine, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::milliseconds(15)))
   , m_pView(pView)
+  , m_cueAnimation(CueKeyframes)
+  , m_playAnimation(PlayKeyframes)
+  , m_cuedStopAnimation(CuedStopKeyframes)
+  , m_stoppedAnimation(StoppedKeyframes)
+  , m_wifiAccessPointAnimation(WifiAccessPointReadyKeyframes)
+  , m_wifiConnectingAnimation(WifiTryingToConnectKeyframes)
+  , m_wifiStatus(-1)
 {}
 
 void ViewUpdateProcess::process() {
@@ -220,30 +653,31 @@ void ViewUpdateProcess::process() {
   m_pView->setLogoLight(beatPhase);
   animatePhase(phase, playState);
   m_pView->displayWifiStatusFrame(getWifiStatusFrame(m_engine.getWifiStatus()));
+  m_pView->FlushLEDs();
   m_pView->ScrollTempMessage();
   m_pView->UpdateDisplay();
 }
 
 void ViewUpdateProcess::animatePhase(float normalizedPhase, Engine::PlayState playState) {
-
-  const int animFrameIndex = min(
-    NUM_ANIM_FRAMES - 1,
-    max(0, (int)floor(normalizedPhase * NUM_ANIM_FRAMES))
-  );
+  float levels[MainView::NumAnimLEDs];
 
   switch (playState) {
     case Engine::PlayState::Cued:
-      m_pView->SetAnimationLEDs(CueAnimationFrames[animFrameIndex]);
+      m_cueAnimation.Render(normalizedPhase, levels);
+      m_pView->SetAnimationLEDs(levels);
       break;
     case Engine::PlayState::Playing:
-      m_pView->SetAnimationLEDs(PlayAnimationFrames[animFrameIndex]);
+      m_playAnimation.Render(normalizedPhase, levels);
+      m_pView->SetAnimationLEDs(levels);
       break;
     case Engine::PlayState::CuedStop:
-      m_pView->SetAnimationLEDs(CuedStopAnimationFrames[animFrameIndex]);
+      m_cuedStopAnimation.Render(normalizedPhase, levels);
+      m_pView->SetAnimationLEDs(levels);
       break;
     case Engine::PlayState::Stopped:
         if (m_engine.GetNumberOfPeers() > 0) {
-          m_pView->SetAnimationLEDs(StoppedAnimationFrames[animFrameIndex]);
+          m_stoppedAnimation.Render(normalizedPhase, levels);
+          m_pView->SetAnimationLEDs(levels);
         } else {
           m_pView->ClearAnimationLEDs();
         }
@@ -255,34 +689,30 @@ void ViewUpdateProcess::animatePhase(float normalizedPhase, Engine::PlayState pl
 }
 
 float ViewUpdateProcess::getWifiStatusFrame(int wifiStatus) {
-  std::vector<float> animationFrames;
-  static int frameCount = 1;
-  static int frameIndex = 0;
-  //int wifiStatus = AP_MODE;
+  const auto now = std::chrono::steady_clock::now();
+  if (wifiStatus != m_wifiStatus) {
+    // Every status starts its animation from the beginning
+    m_wifiStatus = wifiStatus;
+    m_wifiStatusSince = now;
+    m_wifiAccessPointAnimation.Rewind();
+    m_wifiConnectingAnimation.Rewind();
+  }
+  const float seconds = std::chrono::duration<float>(now - m_wifiStatusSince).count();
+
+  float level = 0;
   switch (wifiStatus) {
     case AP_MODE :
-      animationFrames = WifiAccessPointReady;
-    break;
-    case TRYING_TO_CONNECT :
-      animationFrames = WifiTryingToConnect;
+      m_wifiAccessPointAnimation.Render(seconds, &level);
       break;
-    case NO_WIFI_FOUND :
-      animationFrames = {0.0};
+    case TRYING_TO_CONNECT :
+      m_wifiConnectingAnimation.Render(seconds, &level);
       break;
     case WIFI_CONNECTED :
-      animationFrames = {1.0};
-      break;
-    case REBOOT :
-      animationFrames = {0.0};
+      level = 1.0;
       break;
     default :
-      animationFrames = {0.0};
+      level = 0.0;
       break;
   }
-  frameCount = animationFrames.size();
-  frameIndex++;
-  if (frameIndex > (frameCount - 1)) {
-    frameIndex = 0;
-  }
-  return animationFrames.at(frameIndex);
+  return level;
 }
@@ -6,36 +6,171 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <queue>
 #include <string>
+#include <vector>
+#include "missing_link/hw_defs.h"
 #include "missing_link/gpio.hpp"
+#include "missing_link/io_expander.hpp"
 #include "missing_link/view.hpp"
+#include "missing_link/deadline_timer.hpp"
+#include "missing_link/animation.hpp"
+#include "missing_link/spsc_queue.hpp"
+#include "missing_link/output_stats.hpp"
 //#include "missing_link/midi_out.hpp"
 
 namespace MissingLink {
 
+  /// A planned output edge on the Link timeline
+  struct EdgeEvent {
+    std::chrono::microseconds time;   // host time to fire, delay compensation applied
+    double tempo;                     // tempo at the time of planning
+    uint8_t channels;                 // bitmask of clock channels with a tick due
+    bool reset;                       // start of loop
+    uint8_t midiByte;                 // 0 if no MIDI message is due
+    unsigned int generation;          // Engine schedule generation it was planned against
+  };
+
+  typedef SPSCQueue<EdgeEvent, 64> EdgeQueue;
+
   class OutputProcess : public Engine::Process {
 
     public:
 
-      OutputProcess(Engine &engine);
+      // Clock channels 1 and up are on the expander outputs, shared with the user input
+      OutputProcess(Engine &engine, std::shared_ptr<EdgeQueue> pEdgeQueue,
+          std::shared_ptr<OutputStats> pStats, std::shared_ptr<IOExpander> pExpander);
       void Run() override;
+      void Notify() override;
 
     private:
 
+      // Lines 0 to ML_NUM_CLOCK_CHANNELS - 1 are the clock channels
+      static const int RESET_LINE = ML_NUM_CLOCK_CHANNELS;
+      static const int NUM_LINES = ML_NUM_CLOCK_CHANNELS + 1;
+
+      // A scheduled level change on an output line
+      struct PulseEvent {
+        std::chrono::microseconds time;
+        int line;
+        bool high;
+        unsigned int sequence;
+      };
+
+      struct PulseEventLater {
+        bool operator()(const PulseEvent &a, const PulseEvent &b) const { return a.time > b.time; }
+      };
+
+      typedef std::priority_queue<PulseEvent, std::vector<PulseEvent>, PulseEventLater> PulseQueue;
+
+      void run() override;
       void process() override;
-      void triggerOutputs(bool clockTriggered, bool resetTriggered);
-      void setClock(bool high);
+      void waitForNextEdge();
+      void fireEdge(const EdgeEvent &event);
+      void stopOutputs();
+      void refreshSettings();
+      void triggerOutputs(const EdgeEvent &event);
+      void schedulePulseEnd(int line, bool high, std::chrono::microseconds time);
+      void firePulseEvents(std::chrono::microseconds now);
+      void clearPulseEvents();
+      void setLine(int line, bool high);
       void setReset(bool high);
+      void writeChannels();
+      void recordClockLatency();
 
-      std::chrono::microseconds m_lastOutTime = std::chrono::microseconds(0);
-      bool m_clockHigh = false;
+      // Channel levels as requested, and as last written to the pins
+      uint8_t m_channelState = 0;
+      uint8_t m_writtenChannelState = 0;
       bool m_resetHigh = false;
 
       bool m_transportStopped = true;
 
+      DeadlineTimer m_timer;
+
+      std::shared_ptr<EdgeQueue> m_pEdgeQueue;
+      std::shared_ptr<OutputStats> m_pStats;
+
+      // Clock edges fired in this pass, not yet written to the pins
+      int m_pendingClockEdges = 0;
+      uint8_t m_pendingClockChannels = 0;
+      std::chrono::microseconds m_pendingClockTime;
+
+      // Settings snapshot, only re-read when the settings generation changes
+      Settings m_settings;
+      unsigned int m_settingsGeneration = ~0u;
+      double m_channelTicksPerBeat[ML_NUM_CLOCK_CHANNELS];
+      // Shortest gap between two ticks of a channel in beats, shortened by swing
+      double m_channelMinGap[ML_NUM_CLOCK_CHANNELS];
+
+      // Pending pulse-off transitions, earliest first
+      PulseQueue m_pulseQueue;
+      // Latest pulse per line, so a stale pulse-off never cuts a newer pulse short
+      unsigned int m_pulseSequence[NUM_LINES] = {};
+
       std::unique_ptr<GPIO::Pin> m_pClockOut;
       std::unique_ptr<GPIO::Pin> m_pResetOut;
+      std::shared_ptr<IOExpander> m_pExpander;
+  };
+
+  // Computes upcoming clock channel, reset and MIDI clock edges from the Link
+  // timeline ahead of time, at a lower priority than the output thread which fires them
+  class EdgePlannerProcess : public Engine::Process {
+
+    public:
+
+      EdgePlannerProcess(Engine &engine, std::shared_ptr<EdgeQueue> pEdgeQueue);
+      void Run() override;
+      void Notify() override;
+
+      // Called from the planner thread after new edges were queued
+      std::function<void()> onEdgesPlanned;
+
+    private:
+
+      // Clock channel settings reduced to what planning needs
+      struct ChannelPlan {
+        bool enabled;
+        double ticksPerBeat;
+        double phase;           // fraction of a tick
+        double swing;           // fraction of a tick every other tick is delayed by
+        int euclidSteps;
+        int euclidPulses;
+        int euclidRotation;
+        long long nextTick;     // next tick that fires
+      };
+
+      void run() override;
+      void process() override;
+      void refreshSettings();
+      void restart(double beats);
+
+      static double tickBeat(const ChannelPlan &channel, long long tick);
+      static bool tickFires(const ChannelPlan &channel, long long tick);
+      static void advance(ChannelPlan &channel);
+
+      DeadlineTimer m_timer;
+
+      std::shared_ptr<EdgeQueue> m_pEdgeQueue;
+
+      // Settings snapshot and values derived from it, only recomputed
+      // when the settings generation changes
+      Settings m_settings;
+      unsigned int m_settingsGeneration = ~0u;
+      ChannelPlan m_channels[ML_NUM_CLOCK_CHANNELS];
+      std::chrono::microseconds m_delay;
+
+      bool m_planning = false;
+      unsigned int m_generation = 0;
+      long long m_nextMidiTick = 0;
+      long long m_nextLoop = 0;
+
+      // Last queued edge, to detect timeline changes that arrive without a callback
+      bool m_hasPlanned = false;
+      double m_lastPlannedBeat = 0.0;
+      std::chrono::microseconds m_lastPlannedTime;
   };
 
   class ViewUpdateProcess : public Engine::Process {
@@ -49,9 +184,20 @@ namespace MissingLink {
       void process() override;
       void animatePhase(float normalizedPhase, Engine::PlayState playState);
 
+      // Perceived brightness of the Wi-Fi LED for this frame
       float getWifiStatusFrame(int wifiStatus);
 
       std::shared_ptr<MainView> m_pView;
+
+      Animation<MainView::NumAnimLEDs> m_cueAnimation;
+      Animation<MainView::NumAnimLEDs> m_playAnimation;
+      Animation<MainView::NumAnimLEDs> m_cuedStopAnimation;
+      Animation<MainView::NumAnimLEDs> m_stoppedAnimation;
+      Animation<1> m_wifiAccessPointAnimation;
+      Animation<1> m_wifiConnectingAnimation;
+
+      int m_wifiStatus;   // animating since m_wifiStatusSince
+      std::chrono::steady_clock::time_point m_wifiStatusSince;
   };
 
 };
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include "missing_link/output_stats.hpp"
+
+using namespace MissingLink;
+
+namespace {
+
+  void printLatency(std::ostream &stream, const char *name, const LatencyHistogram &histogram) {
+    const auto summary = histogram.GetSummary();
+    stream << "  " << name << ": " << summary.count << " edges"
+           << ", p50 " << summary.p50.count() << "us"
+           << ", p99 " << summary.p99.count() << "us"
+           << ", max " << summary.max.count() << "us\n";
+  }
+
+}
+
+OutputStats::OutputStats()
+  : missedEdges(0)
+  , mergedEdges(0)
+  , loopOverruns(0)
+{}
+
+void OutputStats::Print(std::ostream &stream) const {
+  stream << "Output timing:\n";
+  printLatency(stream, "clock", clockLatency);
+  printLatency(stream, "expander clock", expanderClockLatency);
+  printLatency(stream, "reset", resetLatency);
+  printLatency(stream, "midi clock", midiClockLatency);
+  stream << "  missed " << missedEdges.load()
+         << ", merged " << mergedEdges.load()
+         << ", overruns " << loopOverruns.load() << "\n";
+}
+
+void OutputStats::Reset() {
+  clockLatency.Reset();
+  expanderClockLatency.Reset();
+  resetLatency.Reset();
+  midiClockLatency.Reset();
+  missedEdges.store(0);
+  mergedEdges.store(0);
+  loopOverruns.store(0);
+}
@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include "missing_link/histogram.hpp"
+
+namespace MissingLink {
+
+  /// Output timing, written by the output thread and read from anywhere.
+  /// Latency is measured from the ideal edge time on the Link timeline to
+  /// just after the pin was written.
+  struct OutputStats {
+
+    LatencyHistogram clockLatency;          // channel 0, on a GPIO
+    LatencyHistogram expanderClockLatency;  // channels 1 and up, I2C bus wait included
+    LatencyHistogram resetLatency;
+    // One sample per port, taken by its sender thread after the send, or
+    // one per clock when it is handed to the sequencer queue: how late it
+    // was by then
+    LatencyHistogram midiClockLatency;
+
+    // Edges fired too late to count as on time, or MIDI messages dropped
+    // because a port's sender fell behind
+    std::atomic<uint32_t> missedEdges;
+    // Edges that went out in the same write as an earlier, separate edge
+    std::atomic<uint32_t> mergedEdges;
+    // Output passes that ended with the next edge already overdue
+    std::atomic<uint32_t> loopOverruns;
+
+    OutputStats();
+
+    void Print(std::ostream &stream) const;
+    void Reset();
+  };
+
+}
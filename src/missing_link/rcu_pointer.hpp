@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace MissingLink {
+
+// Pointer to an immutable object that readers use without locks, while a
+// writer swaps in a replacement. The old object is only deleted after a
+// grace period: once every reader that could have loaded it has left its
+// ReadLock. Readers are counted per generation, and a swap starts a new
+// one, so readers arriving after it never hold the writer up.
+//
+// Readers never wait. Publish() waits for the grace period, so it must not
+// be called from a realtime thread, and writers must be serialized.
+template <typename T>
+class RcuPointer {
+
+  public:
+
+    class ReadLock {
+
+      public:
+
+        ReadLock(const RcuPointer &pointer)
+          : m_pointer(pointer)
+        {
+          // Announce the reader before loading, so a writer that swapped
+          // after our load is guaranteed to see us in our generation and
+          // wait. If a generation ended meanwhile, count in the new one.
+          while (true) {
+            const unsigned int generation = m_pointer.m_generation.load(std::memory_order_seq_cst);
+            m_generation = generation & 1;
+            m_pointer.m_readers[m_generation].fetch_add(1, std::memory_order_seq_cst);
+            if (m_pointer.m_generation.load(std::memory_order_seq_cst) == generation) { break; }
+            m_pointer.m_readers[m_generation].fetch_sub(1, std::memory_order_release);
+          }
+          m_pObject = m_pointer.m_pCurrent.load(std::memory_order_seq_cst);
+        }
+
+        ~ReadLock() {
+          m_pointer.m_readers[m_generation].fetch_sub(1, std::memory_order_release);
+        }
+
+        ReadLock(const ReadLock &) = delete;
+        ReadLock &operator=(const ReadLock &) = delete;
+
+        const T *get() const { return m_pObject; }
+        const T *operator->() const { return m_pObject; }
+        explicit operator bool() const { return m_pObject != nullptr; }
+
+      private:
+
+        const RcuPointer &m_pointer;
+        unsigned int m_generation;
+        const T *m_pObject;
+    };
+
+    explicit RcuPointer(std::unique_ptr<T> pInitial = nullptr)
+      : m_pCurrent(pInitial.release())
+      , m_generation(0)
+    {
+      m_readers[0].store(0);
+      m_readers[1].store(0);
+    }
+
+    ~RcuPointer() {
+      delete m_pCurrent.load();
+    }
+
+    RcuPointer(const RcuPointer &) = delete;
+    RcuPointer &operator=(const RcuPointer &) = delete;
+
+    // Replaces the object and deletes the previous one once no reader can
+    // still see it
+    void Publish(std::unique_ptr<T> pNext) {
+      T *pPrevious = m_pCurrent.exchange(pNext.release(), std::memory_order_seq_cst);
+      // Readers of the previous object all entered in the generation that
+      // ends here. Later ones count in the next one and see the new object.
+      const unsigned int previous = m_generation.fetch_add(1, std::memory_order_seq_cst) & 1;
+      while (m_readers[previous].load(std::memory_order_seq_cst) != 0) {
+        std::this_thread::yield();
+      }
+      delete pPrevious;
+    }
+
+  private:
+
+    std::atomic<T *> m_pCurrent;
+    std::atomic<unsigned int> m_generation;
+    mutable std::atomic<unsigned int> m_readers[2];   // by generation parity
+};
+
+}
@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include "missing_link/reactor.hpp"
+
+using namespace MissingLink;
+
+namespace MissingLink {
+
+  // Events handled per epoll_wait call
+  static const int MaxReactorEvents = 16;
+
+  static timespec toTimespec(std::chrono::milliseconds duration) {
+    const auto secs = std::chrono::duration_cast<std::chrono::seconds>(duration);
+    timespec ts;
+    ts.tv_sec = secs.count();
+    ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(duration - secs).count();
+    return ts;
+  }
+
+}
+
+Reactor::Reactor()
+  : m_epollFd(-1)
+  , m_eventFd(-1)
+  , m_inotifyFd(-1)
+  , m_running(true)
+{
+  open();
+}
+
+Reactor::~Reactor() {
+  close();
+}
+
+void Reactor::Run() {
+  if (m_epollFd < 0) { return; }
+
+  epoll_event events[MaxReactorEvents];
+  while (m_running) {
+    const int count = ::epoll_wait(m_epollFd, events, MaxReactorEvents, -1);
+    if (count < 0) {
+      if (errno == EINTR) { continue; }
+      std::cerr << "Reactor wait failed: " << std::strerror(errno) << std::endl;
+      break;
+    }
+    for (int i = 0; i < count && m_running; i++) {
+      auto it = m_fdHandlers.find(events[i].data.fd);
+      if (it == m_fdHandlers.end()) { continue; }
+      // A copy, the handler may unwatch itself
+      FdHandler handler = it->second;
+      handler(events[i].events);
+    }
+  }
+}
+
+void Reactor::Stop() {
+  m_running = false;
+  Post(Handler());
+}
+
+void Reactor::Post(Handler handler) {
+  {
+    std::lock_guard<std::mutex> lock(m_postMutex);
+    m_posted.push_back(handler);
+  }
+  if (m_eventFd >= 0) {
+    uint64_t one = 1;
+    // Only fails if the counter is about to overflow, then it's signalled anyway
+    if (::write(m_eventFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+      std::cerr << "Failed to wake reactor: " << std::strerror(errno) << std::endl;
+    }
+  }
+}
+
+bool Reactor::Watch(int fd, uint32_t events, FdHandler handler) {
+  if (m_epollFd < 0 || fd < 0) { return false; }
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  const int op = m_fdHandlers.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (::epoll_ctl(m_epollFd, op, fd, &event) < 0) {
+    std::cerr << "Failed to watch fd " << fd << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  m_fdHandlers[fd] = handler;
+  return true;
+}
+
+void Reactor::Unwatch(int fd) {
+  if (m_fdHandlers.erase(fd) > 0) {
+    ::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+int Reactor::AddTimer(Handler handler) {
+  const int timerFd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timerFd < 0) {
+    std::cerr << "Failed to create timerfd: " << std::strerror(errno) << std::endl;
+    return -1;
+  }
+  const bool watched = Watch(timerFd, EPOLLIN, [timerFd, handler](uint32_t) {
+    uint64_t expirations;
+    if (::read(timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+      // Missed expirations are folded into one call
+      handler();
+    }
+  });
+  if (!watched) {
+    ::close(timerFd);
+    return -1;
+  }
+  m_timerFds.insert(timerFd);
+  return timerFd;
+}
+
+void Reactor::RemoveTimer(int timer) {
+  if (m_timerFds.erase(timer) > 0) {
+    Unwatch(timer);
+    ::close(timer);
+  }
+}
+
+void Reactor::SetTimer(int timer, std::chrono::milliseconds delay, std::chrono::milliseconds interval) {
+  if (timer < 0) { return; }
+  itimerspec spec;
+  spec.it_value = toTimespec(delay);
+  spec.it_interval = toTimespec(interval);
+  if (::timerfd_settime(timer, 0, &spec, nullptr) < 0) {
+    std::cerr << "Failed to arm timer: " << std::strerror(errno) << std::endl;
+  }
+}
+
+int Reactor::AddPeriodic(std::chrono::milliseconds interval, Handler handler) {
+  const int timer = AddTimer(handler);
+  SetTimer(timer, interval, interval);
+  return timer;
+}
+
+bool Reactor::WatchPath(const std::string &path, uint32_t mask, PathHandler handler) {
+  if (m_inotifyFd < 0) { return false; }
+  const int wd = ::inotify_add_watch(m_inotifyFd, path.c_str(), mask);
+  if (wd < 0) {
+    std::cerr << "Failed to watch " << path << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  m_pathHandlers[wd] = handler;
+  return true;
+}
+
+void Reactor::open() {
+  if ((m_epollFd = ::epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    std::cerr << "Failed to create epoll instance: " << std::strerror(errno) << std::endl;
+    return;
+  }
+
+  if ((m_eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+    std::cerr << "Failed to create eventfd: " << std::strerror(errno) << std::endl;
+  } else {
+    Watch(m_eventFd, EPOLLIN, [this](uint32_t) { runPosted(); });
+  }
+
+  if ((m_inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+    std::cerr << "Failed to create inotify instance: " << std::strerror(errno) << std::endl;
+  } else {
+    Watch(m_inotifyFd, EPOLLIN, [this](uint32_t) { readInotify(); });
+  }
+}
+
+void Reactor::close() {
+  // Other watched fds belong to whoever watches them
+  for (int timer : m_timerFds) {
+    ::close(timer);
+  }
+  m_timerFds.clear();
+  m_fdHandlers.clear();
+  if (m_inotifyFd >= 0) {
+    ::close(m_inotifyFd);
+    m_inotifyFd = -1;
+  }
+  if (m_eventFd >= 0) {
+    ::close(m_eventFd);
+    m_eventFd = -1;
+  }
+  if (m_epollFd >= 0) {
+    ::close(m_epollFd);
+    m_epollFd = -1;
+  }
+}
+
+void Reactor::runPosted() {
+  uint64_t count;
+  if (::read(m_eventFd, &count, sizeof(count)) != sizeof(count)) {
+    // Spurious wakeup, nothing was posted
+    return;
+  }
+
+  std::deque<Handler> posted;
+  {
+    std::lock_guard<std::mutex> lock(m_postMutex);
+    posted.swap(m_posted);
+  }
+  for (auto &handler : posted) {
+    if (handler) { handler(); }
+  }
+}
+
+void Reactor::readInotify() {
+  // Aligned for the inotify_event structs packed into it
+  alignas(inotify_event) char buffer[4096];
+  ssize_t length;
+  while ((length = ::read(m_inotifyFd, buffer, sizeof(buffer))) > 0) {
+    for (char *p = buffer; p < buffer + length; ) {
+      const inotify_event *event = reinterpret_cast<const inotify_event*>(p);
+      p += sizeof(inotify_event) + event->len;
+      auto it = m_pathHandlers.find(event->wd);
+      if (it == m_pathHandlers.end()) { continue; }
+      const std::string name = event->len > 0 ? std::string(event->name) : std::string();
+      it->second(name, event->mask);
+    }
+  }
+}
@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <atomic>
+
+namespace MissingLink {
+
+// Single threaded event loop on epoll for all the housekeeping that has no
+// timing requirements: user input, periodic jobs, file changes and
+// commands from other threads. The thread calling Run() sleeps until one
+// of them has work, so it never competes with the output thread for
+// nothing.
+//
+// Handlers run on the reactor thread. Watches and timers may be added
+// before Run() or from a handler; other threads go through Post().
+class Reactor {
+
+  public:
+
+    typedef std::function<void()> Handler;
+    typedef std::function<void(uint32_t events)> FdHandler;
+    typedef std::function<void(const std::string &name, uint32_t mask)> PathHandler;
+
+    Reactor();
+    virtual ~Reactor();
+
+    // Dispatch events until Stop()
+    void Run();
+
+    // Makes Run() return, or return right away if it hasn't started yet.
+    // Safe from any thread.
+    void Stop();
+
+    // Run the handler on the reactor thread. Safe from any thread.
+    void Post(Handler handler);
+
+    // Call the handler with the epoll events whenever fd has any of the given
+    // events. The fd stays the caller's, who must Unwatch() it before closing it.
+    bool Watch(int fd, uint32_t events, FdHandler handler);
+    void Unwatch(int fd);
+
+    // Timers are created disarmed and owned by the reactor. Returns -1 on failure.
+    int AddTimer(Handler handler);
+    void RemoveTimer(int timer);
+
+    // Fire after delay, then every interval if it isn't zero. A zero delay disarms.
+    void SetTimer(int timer, std::chrono::milliseconds delay,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(0));
+
+    // Shorthand for a timer firing every interval
+    int AddPeriodic(std::chrono::milliseconds interval, Handler handler);
+
+    // inotify watch on a file or directory, mask is IN_* flags. The handler
+    // gets the name of the entry that changed, empty for the path itself.
+    bool WatchPath(const std::string &path, uint32_t mask, PathHandler handler);
+
+  private:
+
+    void open();
+    void close();
+    void runPosted();
+    void readInotify();
+
+    int m_epollFd;
+    int m_eventFd;
+    int m_inotifyFd;
+    std::atomic<bool> m_running;
+
+    std::map<int, FdHandler> m_fdHandlers;
+    std::set<int> m_timerFds;   // the only watched fds closed by the reactor
+    std::map<int, PathHandler> m_pathHandlers;
+
+    std::mutex m_postMutex;
+    std::deque<Handler> m_posted;
+};
+
+}
@@ -5,65 +5,282 @@
 
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <vector>
 #include <libconfig.h++>
 #include "missing_link/settings.hpp"
+#include "missing_link/hardware.hpp"
 
 #define ML_CONFIG_FILE "/etc/missing_link.cfg"
 
+// Previous good copy of the config file, loaded if the current one is corrupt
+#define ML_CONFIG_BACKUP_FILE ML_CONFIG_FILE ".bak"
+
+// Compact binary copy of the settings, read instead of parsing the config file
+#define ML_SETTINGS_RECORD_FILE "/etc/missing_link.rec"
+
 using namespace libconfig;
 using namespace MissingLink;
 
 const std::vector<int> Settings :: ppqn_options ({1, 2, 4, 8, 12, 16, 24, 32});
 
-Settings Settings::Load() {
-  Settings settings;
-  Config config;
-  bool valid = false;
+namespace MissingLink {
 
-  try {
-    config.readFile(ML_CONFIG_FILE);
-    valid = true;
-  } catch (const FileIOException &exc) {
-    std::cerr << "Failed to read config file" << std::endl;
-  } catch (const ParseException &exc) {
-    std::cerr << "Failed to parse config file" << std::endl;
+  // Settings record header. The record is a raw copy of Settings, only
+  // readable by a build with the same layout. Reordering fields or changing
+  // a type can keep the size, so the layout version must be bumped with
+  // any change to Settings, ClockChannel or PulseWidth.
+  struct SettingsRecordHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t crc;
+  };
+
+  static const uint32_t SettingsRecordMagic = 0x4d4c5331; // "MLS1"
+  static const uint32_t SettingsLayoutVersion = 1;
+
+  // Fields used as indexes or enums back in range, whatever was loaded
+  static void clampSettings(Settings &settings) {
+    const int ppqnOptions = Settings::ppqn_options.size();
+    settings.ppqn_index = std::min(ppqnOptions - 1, std::max(0, settings.ppqn_index));
+    settings.reset_mode = std::min(2, std::max(0, settings.reset_mode));
+    settings.quantum = std::max(1, settings.quantum);
+    if (!(settings.tempo > 0)) {
+      settings.tempo = Settings().tempo;
+    }
+    const int clockSource = static_cast<int>(settings.clock_source);
+    if (clockSource < 0 || clockSource > 2) {
+      settings.clock_source = ClockSource::Link;
+    }
+  }
+
+  static uint32_t crc32(const void *data, size_t length) {
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady) {
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+          c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+      }
+      tableReady = true;
+    }
+    uint32_t crc = 0xFFFFFFFF;
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; i++) {
+      crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+  }
+
+  static bool isNewer(const char *path, const char *than) {
+    struct stat a, b;
+    if (::stat(path, &a) != 0) { return false; }
+    if (::stat(than, &b) != 0) { return true; }
+    return a.st_mtime >= b.st_mtime;
   }
 
-  if (!valid) {
-    // indiscriminately delete file and return defaults
-    ::remove(ML_CONFIG_FILE);
+  static bool syncAndClose(FILE *file) {
+    bool ok = fflush(file) == 0;
+    int fd = fileno(file);
+    if (fd >= 0) {
+      ok = fsync(fd) == 0 && ok;
+    }
+    return fclose(file) == 0 && ok;
+  }
+
+  // Put a written and synced temp file in place of path. Renames are atomic,
+  // so after a crash there is always a complete file, new or old.
+  static bool replaceFile(const std::string &tmpPath, const std::string &path, const char *backupPath) {
+    if (backupPath != nullptr && ::rename(path.c_str(), backupPath) != 0 && errno != ENOENT) {
+      std::cerr << "Failed to keep backup of " << path << ": " << std::strerror(errno) << std::endl;
+    }
+    if (::rename(tmpPath.c_str(), path.c_str()) != 0) {
+      std::cerr << "Failed to replace " << path << ": " << std::strerror(errno) << std::endl;
+      ::remove(tmpPath.c_str());
+      return false;
+    }
+    // Make the renames themselves durable
+    const std::string dir = path.substr(0, path.find_last_of('/') + 1);
+    int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd >= 0) {
+      fsync(dirFd);
+      ::close(dirFd);
+    }
+    return true;
+  }
+
+  static bool readRecord(Settings &settings) {
+    FILE *file = fopen(ML_SETTINGS_RECORD_FILE, "rb");
+    if (file == NULL) {
+      return false;
+    }
+    SettingsRecordHeader header;
+    Settings record;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+      header.magic == SettingsRecordMagic &&
+      header.version == SettingsLayoutVersion &&
+      header.size == sizeof(Settings) &&
+      fread(&record, sizeof(record), 1, file) == 1 &&
+      header.crc == crc32(&record, sizeof(record));
+    fclose(file);
+    if (!valid) {
+      std::cerr << "Ignoring invalid settings record" << std::endl;
+      return false;
+    }
+    std::memcpy(&settings, &record, sizeof(Settings));
+    return true;
+  }
+
+  static void writeRecord(const Settings &settings) {
+    const std::string tmpPath = std::string(ML_SETTINGS_RECORD_FILE) + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == NULL) {
+      std::cerr << "Failed to open settings record for writing" << std::endl;
+      return;
+    }
+    SettingsRecordHeader header = { SettingsRecordMagic, SettingsLayoutVersion, sizeof(Settings), crc32(&settings, sizeof(Settings)) };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(&settings, sizeof(Settings), 1, file) == 1;
+    ok = syncAndClose(file) && ok;
+    if (!ok) {
+      std::cerr << "Failed to write settings record" << std::endl;
+      ::remove(tmpPath.c_str());
+      return;
+    }
+    replaceFile(tmpPath, ML_SETTINGS_RECORD_FILE, nullptr);
+  }
+
+  static bool readConfig(const char *path, Settings &settings) {
+    Config config;
+
+    try {
+      config.readFile(path);
+    } catch (const FileIOException &exc) {
+      std::cerr << "Failed to read config file " << path << std::endl;
+      return false;
+    } catch (const ParseException &exc) {
+      std::cerr << "Failed to parse config file " << path << std::endl;
+      return false;
+    }
+
+    try {
+      settings.tempo = config.lookup("tempo");
+      settings.quantum = config.lookup("quantum");
+      settings.ppqn_index = config.lookup("ppqn_index");
+      settings.reset_mode = config.lookup("reset_mode");
+      settings.delay_compensation = config.lookup("delay_compensation");
+      settings.start_stop_sync = config.lookup("start_stop_sync");
+    } catch (const SettingNotFoundException &exc) {
+      std::cerr << "One or more settings missing from config file" << std::endl;
+    }
+
+    config.lookupValue("reset_pulse_width", settings.reset_pulse.value);
+    config.lookupValue("reset_pulse_percent", settings.reset_pulse.percent);
+    config.lookupValue("midi_sequencer", settings.midi_sequencer);
+    int clockSource = 0;
+    if (config.lookupValue("clock_source", clockSource) && clockSource >= 0 && clockSource <= 2) {
+      settings.clock_source = static_cast<ClockSource>(clockSource);
+    }
+    config.lookupValue("settings_record", settings.settings_record);
+    config.lookupValue("tap_window", settings.tap_window);
+    config.lookupValue("tap_whole_bpm", settings.tap_whole_bpm);
+    config.lookupValue("tap_align_beat", settings.tap_align_beat);
+
+    // Channel table is optional, missing channels and fields keep their defaults
+    if (config.exists("channels")) {
+      const Setting &channels = config.lookup("channels");
+      int count = std::min(channels.getLength(), ML_NUM_CLOCK_CHANNELS);
+      for (int i = 0; i < count; i++) {
+        const Setting &entry = channels[i];
+        ClockChannel &channel = settings.channels[i];
+        entry.lookupValue("enabled", channel.enabled);
+        entry.lookupValue("multiply", channel.multiply);
+        entry.lookupValue("divide", channel.divide);
+        entry.lookupValue("phase", channel.phase);
+        entry.lookupValue("swing", channel.swing);
+        entry.lookupValue("euclid_steps", channel.euclid_steps);
+        entry.lookupValue("euclid_pulses", channel.euclid_pulses);
+        entry.lookupValue("euclid_rotation", channel.euclid_rotation);
+        entry.lookupValue("pulse_width", channel.pulse.value);
+        entry.lookupValue("pulse_percent", channel.pulse.percent);
+      }
+    }
+    return true;
+  }
+
+}
+
+Settings Settings::Load() {
+  Settings settings;
+
+  // A simulated unit must never touch the real unit's config
+  if (Hardware::IsSimulated()) {
     return settings;
   }
 
-  try {
-    settings.tempo = config.lookup("tempo");
-    settings.quantum = config.lookup("quantum");
-    settings.ppqn_index = config.lookup("ppqn_index");
-    settings.reset_mode = config.lookup("reset_mode");
-    settings.delay_compensation = config.lookup("delay_compensation");
-    settings.start_stop_sync = config.lookup("start_stop_sync");
-  } catch (const SettingNotFoundException &exc) {
-    std::cerr << "One or more settings missing from config file" << std::endl;
+  const char *source;
+  if (isNewer(ML_SETTINGS_RECORD_FILE, ML_CONFIG_FILE) && readRecord(settings)) {
+    // Unless the config file was edited by hand since the last save
+    source = ML_SETTINGS_RECORD_FILE;
+  } else if (readConfig(ML_CONFIG_FILE, settings)) {
+    source = ML_CONFIG_FILE;
+  } else if (readConfig(ML_CONFIG_BACKUP_FILE, settings)) {
+    source = ML_CONFIG_BACKUP_FILE;
+  } else {
+    // Keep the broken files around, the next save replaces them
+    return Settings();
   }
+  clampSettings(settings);
 
   std::cout << std::setprecision(1) << std::setiosflags(std::ios::fixed) <<
     "Loaded Settings: " <<
-    ML_CONFIG_FILE <<
+    source <<
     "\n  tempo: " << settings.tempo <<
     "\n  quantum: " << settings.quantum <<
     "\n  ppqn: " << settings.getPPQN() <<
     "\n  reset_mode: " << settings.reset_mode <<
     "\n  delay_compensation: " << settings.delay_compensation <<
-    "\n  start_stop_sync: " << settings.start_stop_sync << std::endl;
+    "\n  start_stop_sync: " << settings.start_stop_sync <<
+    "\n  reset_pulse_width: " << settings.reset_pulse.value << (settings.reset_pulse.percent ? "%" : "ms") <<
+    "\n  midi_sequencer: " << settings.midi_sequencer <<
+    "\n  clock_source: " << static_cast<int>(settings.clock_source) <<
+    "\n  tap_window: " << settings.tap_window <<
+    "\n  tap_whole_bpm: " << settings.tap_whole_bpm <<
+    "\n  tap_align_beat: " << settings.tap_align_beat << std::endl;
+
+  for (int i = 0; i < ML_NUM_CLOCK_CHANNELS; i++) {
+    const ClockChannel &channel = settings.channels[i];
+    if (!channel.enabled) { continue; }
+    std::cout <<
+      "  channel " << i << ": " << channel.multiply << "/" << channel.divide <<
+      " phase " << channel.phase << "% swing " << channel.swing << "%";
+    if (channel.euclid_steps > 0) {
+      std::cout << " euclid " << channel.euclid_pulses << "/" << channel.euclid_steps << "+" << channel.euclid_rotation;
+    }
+    std::cout << " pulse " << channel.pulse.value << (channel.pulse.percent ? "%" : "ms") << std::endl;
+  }
 
   return settings;
 }
 
 void Settings::Save(const Settings settings) {
-  FILE *file = fopen(ML_CONFIG_FILE, "wt");
+  if (Hardware::IsSimulated()) {
+    return;
+  }
+
+  const std::string tmpPath = std::string(ML_CONFIG_FILE) + ".tmp";
+  FILE *file = fopen(tmpPath.c_str(), "wt");
   if (file == NULL) {
     std::cerr << "Failed to open config file for writing" << std::endl;
     return;
@@ -78,23 +295,75 @@ void Settings::Save(const Settings settings) {
   root.add("reset_mode", Setting::TypeInt) = settings.reset_mode;
   root.add("delay_compensation", Setting::TypeInt) = settings.delay_compensation;
   root.add("start_stop_sync", Setting::TypeBoolean) = settings.start_stop_sync;
+  root.add("reset_pulse_width", Setting::TypeInt) = settings.reset_pulse.value;
+  root.add("reset_pulse_percent", Setting::TypeBoolean) = settings.reset_pulse.percent;
+  root.add("midi_sequencer", Setting::TypeBoolean) = settings.midi_sequencer;
+  root.add("clock_source", Setting::TypeInt) = static_cast<int>(settings.clock_source);
+  root.add("settings_record", Setting::TypeBoolean) = settings.settings_record;
+  root.add("tap_window", Setting::TypeInt) = settings.tap_window;
+  root.add("tap_whole_bpm", Setting::TypeBoolean) = settings.tap_whole_bpm;
+  root.add("tap_align_beat", Setting::TypeBoolean) = settings.tap_align_beat;
 
+  Setting &channels = root.add("channels", Setting::TypeList);
+  for (int i = 0; i < ML_NUM_CLOCK_CHANNELS; i++) {
+    const ClockChannel &channel = settings.channels[i];
+    Setting &entry = channels.add(Setting::TypeGroup);
+    entry.add("enabled", Setting::TypeBoolean) = channel.enabled;
+    entry.add("multiply", Setting::TypeInt) = channel.multiply;
+    entry.add("divide", Setting::TypeInt) = channel.divide;
+    entry.add("phase", Setting::TypeInt) = channel.phase;
+    entry.add("swing", Setting::TypeInt) = channel.swing;
+    entry.add("euclid_steps", Setting::TypeInt) = channel.euclid_steps;
+    entry.add("euclid_pulses", Setting::TypeInt) = channel.euclid_pulses;
+    entry.add("euclid_rotation", Setting::TypeInt) = channel.euclid_rotation;
+    entry.add("pulse_width", Setting::TypeInt) = channel.pulse.value;
+    entry.add("pulse_percent", Setting::TypeBoolean) = channel.pulse.percent;
+  }
+
+  bool written = true;
   try {
     config.write(file);
   } catch (const FileIOException &exc) {
     std::cerr << "Failed to write settings to config file" << std::endl;
+    written = false;
   }
 
-  // Explicitly synchronize file
-  fflush(file);
-  int fd = fileno(file);
-  if (fd >= 0) {
-    fsync(fd);
+  // Explicitly synchronize file before it replaces the old one
+  if (!syncAndClose(file) || !written) {
+    ::remove(tmpPath.c_str());
+    return;
+  }
+  if (!replaceFile(tmpPath, ML_CONFIG_FILE, ML_CONFIG_BACKUP_FILE)) {
+    return;
   }
 
-  fclose(file);
+  // Written last so it is never older than the config file it mirrors
+  if (settings.settings_record) {
+    writeRecord(settings);
+  } else {
+    ::remove(ML_SETTINGS_RECORD_FILE);
+  }
 }
 
 int Settings::getPPQN() const {
   return ppqn_options[ppqn_index];
 }
+
+std::chrono::microseconds PulseWidth::getDuration(std::chrono::microseconds period) const {
+  long long width;
+  if (percent) {
+    width = period.count() * value / 100;
+  } else {
+    width = value * 1000LL;
+  }
+  long long maxWidth = period.count() * 9 / 10;
+  return std::chrono::microseconds(std::max(0LL, std::min(width, maxWidth)));
+}
+
+double ClockChannel::getTicksPerBeat(int ppqn) const {
+  return (double)ppqn * (double)std::max(1, multiply) / (double)std::max(1, divide);
+}
+
+double ClockChannel::getSwingDelay() const {
+  return (std::min(75, std::max(50, swing)) - 50) / 50.0;
+}
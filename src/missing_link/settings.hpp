@@ -5,8 +5,55 @@
 
 #pragma once
 
+#include <chrono>
+#include <vector>
+#include "missing_link/hw_defs.h"
+
 namespace MissingLink {
 
+/// Width of an output pulse, in milliseconds or as a percentage of the tick period
+struct PulseWidth {
+
+  int value;
+  bool percent;
+
+  // Pulse duration for the given tick period, clamped so that a pulse
+  // always ends before the next tick starts
+  std::chrono::microseconds getDuration(std::chrono::microseconds period) const;
+
+};
+
+/// Where the tempo and phase come from
+enum class ClockSource {
+  Link,     // lead or join the Link session
+  Midi,     // follow MIDI clock input
+  Analog    // follow pulses on the analog clock input, at the configured PPQN
+};
+
+/// Configuration for one clock output channel
+struct ClockChannel {
+
+  bool enabled;
+  int multiply;         // channel ticks per global PPQN tick...
+  int divide;           // ...divided by this, e.g. 1/3 or 4/1
+  int phase;            // offset as a percentage of a channel tick
+  int swing;            // 50 = straight, up to 75 delays every other tick
+  int euclid_steps;     // Euclidean pattern length, 0 = every tick fires
+  int euclid_pulses;    // pulses spread evenly over euclid_steps
+  int euclid_rotation;  // pattern rotation in steps
+  PulseWidth pulse;
+
+  ClockChannel() : enabled(false), multiply(1), divide(1), phase(0), swing(50),
+    euclid_steps(0), euclid_pulses(0), euclid_rotation(0), pulse{5, false} {}
+
+  // Channel ticks per beat at the given global PPQN
+  double getTicksPerBeat(int ppqn) const;
+
+  // Fraction of a tick every other tick is delayed by (0 - 0.5)
+  double getSwingDelay() const;
+
+};
+
 /// POD struct represeting persistent link engine settings
 struct Settings {
 
@@ -17,14 +64,29 @@ struct Settings {
   static const std::vector<int> ppqn_options;
   int delay_compensation;
   bool start_stop_sync;
+  PulseWidth reset_pulse;
+  ClockChannel channels[ML_NUM_CLOCK_CHANNELS];
+  bool midi_sequencer;  // schedule MIDI clock ahead through the ALSA sequencer
+  ClockSource clock_source;
+  bool settings_record; // also save a binary copy that loads without parsing the config file
+  int tap_window;       // taps the tap tempo is fitted to
+  bool tap_whole_bpm;   // round tap tempo to whole BPM instead of tenths
+  bool tap_align_beat;  // tapping also moves the beat grid onto the taps
 
   // Defaults
-  Settings() : tempo(120.0), quantum(4), ppqn_index(2), reset_mode(0), delay_compensation(0), start_stop_sync(false) {}
+  Settings() : tempo(120.0), quantum(4), ppqn_index(2), reset_mode(0), delay_compensation(0), start_stop_sync(false),
+    reset_pulse{5, false}, midi_sequencer(true), clock_source(ClockSource::Link), settings_record(true),
+    tap_window(6), tap_whole_bpm(false), tap_align_beat(false) {
+    // Channel 0 is the main clock output
+    channels[0].enabled = true;
+  }
 
-  // Load from config file
+  // Load from the settings record or the config file, falling back to
+  // the previous config file if the current one is corrupt
   static Settings Load();
 
-  // Save to config file
+  // Save to config file (and settings record) through a temp file and
+  // rename, so a crash or power cut never leaves a half written file
   static void Save(const Settings settings);
 
   //look up ppqn value in ppqn_options vector
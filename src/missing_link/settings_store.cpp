@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <cstring>
+#include "missing_link/settings_store.hpp"
+
+using namespace MissingLink;
+
+SettingsStore::SettingsStore(const Settings &settings)
+  : m_generation(0)
+{
+  for (auto &slot : m_slots) {
+    slot.sequence.store(0);
+    slot.settings = settings;
+  }
+}
+
+Settings SettingsStore::Load() const {
+  Settings settings;
+  Load(settings);
+  return settings;
+}
+
+unsigned int SettingsStore::Load(Settings &settings) const {
+  while (true) {
+    const unsigned int generation = m_generation.load(std::memory_order_acquire);
+    const Slot &slot = m_slots[generation & 1];
+
+    const unsigned int before = slot.sequence.load(std::memory_order_acquire);
+    if ((before & 1) == 0) {
+      std::memcpy(&settings, &slot.settings, sizeof(Settings));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // Only fails if a writer lapped us twice during the copy; the
+      // published slot is always complete, so retrying always makes progress
+      if (slot.sequence.load(std::memory_order_relaxed) == before) {
+        return generation;
+      }
+    }
+  }
+}
+
+void SettingsStore::Store(const Settings &settings) {
+  {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    publish(settings);
+  }
+  changed();
+}
+
+Settings SettingsStore::read(unsigned int generation) const {
+  // Only called with the write lock held, so the slot can't change under us
+  return m_slots[generation & 1].settings;
+}
+
+void SettingsStore::publish(const Settings &settings) {
+  const unsigned int generation = m_generation.load(std::memory_order_relaxed) + 1;
+  Slot &slot = m_slots[generation & 1];
+
+  const unsigned int sequence = slot.sequence.load(std::memory_order_relaxed);
+  slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(&slot.settings, &settings, sizeof(Settings));
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+
+  m_generation.store(generation, std::memory_order_release);
+}
@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include "missing_link/settings.hpp"
+
+namespace MissingLink {
+
+/// Versioned Settings holder for sharing with the realtime threads.
+/// Readers never lock or wait on a writer: every write goes into the slot
+/// readers are not using and is then published by bumping the generation.
+/// Writers are serialized among themselves.
+class SettingsStore {
+
+  public:
+
+    SettingsStore(const Settings &settings);
+
+    // Consistent copy of the current settings
+    Settings Load() const;
+
+    // Consistent copy of the current settings, returns its generation
+    unsigned int Load(Settings &settings) const;
+
+    // Changes every time new settings are published
+    unsigned int GetGeneration() const { return m_generation.load(std::memory_order_acquire); }
+
+    void Store(const Settings &settings);
+
+    // Read-modify-write, so concurrent writers never lose each other's changes
+    template <typename Modifier>
+    Settings Update(Modifier modify) {
+      Settings settings;
+      {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        settings = read(m_generation.load(std::memory_order_relaxed));
+        modify(settings);
+        publish(settings);
+      }
+      changed();
+      return settings;
+    }
+
+    // Called on the writer's thread after every Store() or Update(),
+    // e.g. to schedule a save. Set it before any writer runs.
+    std::function<void()> onChanged;
+
+  private:
+
+    struct Slot {
+      std::atomic<unsigned int> sequence; // odd while being written
+      Settings settings;
+    };
+
+    Slot m_slots[2];
+    std::atomic<unsigned int> m_generation;
+    std::mutex m_writeMutex;
+
+    Settings read(unsigned int generation) const;
+    void publish(const Settings &settings);
+    void changed() { if (onChanged) { onChanged(); } }
+};
+
+}
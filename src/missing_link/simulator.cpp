@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include "missing_link/types.hpp"
+#include "missing_link/simulator.hpp"
+
+using namespace MissingLink;
+
+namespace {
+
+  int64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+  }
+
+  // Address space of the parts on the board, by I2C address
+  uint8_t addressMaskFor(uint8_t devAddr) {
+    switch (devAddr) {
+      case 0x20: return 0x0F; // MCP23008, 11 registers
+      case 0x60: return 0x1F; // TLC59116, upper 3 bits are auto-increment control
+      default:   return 0xFF; // HT16K33 and anything else
+    }
+  }
+
+  void resetPin(Simulator::PinState &pin) {
+    // Idle high, like the pulled up interrupt line
+    pin.high.store(true);
+    pin.writes.store(0);
+    pin.risingEdges.store(0);
+    pin.lastWriteNanos.store(0);
+  }
+
+}
+
+SimulatedRegisters::SimulatedRegisters(uint8_t addressMask)
+  : m_addressMask(addressMask)
+  , m_lastCommand(0)
+{
+  for (auto &reg : m_registers) {
+    reg.store(0);
+  }
+}
+
+uint8_t SimulatedRegisters::Read(uint8_t regAddr) const {
+  return m_registers[regAddr & m_addressMask].load(std::memory_order_relaxed);
+}
+
+void SimulatedRegisters::Write(uint8_t regAddr, uint8_t value) {
+  m_registers[regAddr & m_addressMask].store(value, std::memory_order_relaxed);
+}
+
+void SimulatedRegisters::WriteBlock(uint8_t regAddr, const uint8_t *values, int nBytes) {
+  for (int i = 0; i < nBytes; i++) {
+    Write((uint8_t)(regAddr + i), values[i]);
+  }
+}
+
+void SimulatedRegisters::Command(uint8_t cmd) {
+  m_lastCommand.store(cmd, std::memory_order_relaxed);
+}
+
+Simulator &Simulator::Get() {
+  static Simulator simulator;
+  return simulator;
+}
+
+Simulator::Simulator()
+  : m_deviceCalls(0)
+{
+  for (auto &pin : m_pins) {
+    resetPin(pin);
+  }
+  resetPin(m_invalidPin);
+  m_midiSink.clocks.store(0);
+  m_midiSink.starts.store(0);
+  m_midiSink.stops.store(0);
+  m_midiSink.other.store(0);
+  m_midiSink.lastClockNanos.store(0);
+}
+
+void Simulator::WritePin(int address, bool high) {
+  PinState &state = pin(address);
+  const bool wasHigh = state.high.exchange(high, std::memory_order_relaxed);
+  if (high && !wasHigh) {
+    state.risingEdges.fetch_add(1, std::memory_order_relaxed);
+  }
+  state.writes.fetch_add(1, std::memory_order_relaxed);
+  state.lastWriteNanos.store(nowNanos(), std::memory_order_relaxed);
+  m_deviceCalls++;
+}
+
+bool Simulator::ReadPin(int address) {
+  m_deviceCalls++;
+  return pin(address).high.load(std::memory_order_relaxed);
+}
+
+void Simulator::SetPin(int address, bool high) {
+  pin(address).high.store(high);
+}
+
+const Simulator::PinState &Simulator::GetPin(int address) const {
+  return const_cast<Simulator *>(this)->pin(address);
+}
+
+SimulatedRegisters *Simulator::OpenI2CDevice(uint8_t bus, uint8_t devAddr) {
+  ScopedMutex lock(m_devicesMutex);
+  auto &device = m_devices[(bus << 8) | devAddr];
+  if (!device) {
+    device = std::unique_ptr<SimulatedRegisters>(new SimulatedRegisters(addressMaskFor(devAddr)));
+    if (devAddr == 0x20) {
+      device->Write(0x00, 0xFF); // MCP23008 IODIR resets to all inputs
+    }
+  }
+  return device.get();
+}
+
+void Simulator::SendMidi(const std::vector<unsigned char> &message) {
+  m_deviceCalls++;
+  if (message.empty()) { return; }
+  switch (message[0]) {
+    case 0xF8:
+      m_midiSink.clocks.fetch_add(1, std::memory_order_relaxed);
+      m_midiSink.lastClockNanos.store(nowNanos(), std::memory_order_relaxed);
+      break;
+    case 0xFA:
+      m_midiSink.starts.fetch_add(1, std::memory_order_relaxed);
+      break;
+    case 0xFC:
+      m_midiSink.stops.fetch_add(1, std::memory_order_relaxed);
+      break;
+    default:
+      m_midiSink.other.fetch_add(1, std::memory_order_relaxed);
+      break;
+  }
+}
+
+Simulator::PinState &Simulator::pin(int address) {
+  if (address < 0 || address >= NUM_PINS) {
+    return m_invalidPin;
+  }
+  return m_pins[address];
+}
@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "missing_link/hardware.hpp"
+
+namespace MissingLink {
+
+// Register file standing in for an I2C device (HT16K33, TLC59116, MCP23008).
+// Register addresses are masked to the device's address space, so control
+// bits like the TLC59116 auto-increment flags don't alias other registers.
+class SimulatedRegisters {
+
+  public:
+
+    SimulatedRegisters(uint8_t addressMask);
+
+    uint8_t Read(uint8_t regAddr) const;
+    void Write(uint8_t regAddr, uint8_t value);
+
+    // Sequential write starting at regAddr, as a block transfer would
+    void WriteBlock(uint8_t regAddr, const uint8_t *values, int nBytes);
+
+    // Single byte commands, e.g. HT16K33 oscillator and blink setup
+    void Command(uint8_t cmd);
+    uint8_t GetLastCommand() const { return m_lastCommand.load(); }
+
+  private:
+
+    const uint8_t m_addressMask;
+    std::atomic<uint8_t> m_registers[256];
+    std::atomic<uint8_t> m_lastCommand;
+};
+
+// Process wide state of the simulated hardware backend. Everything a
+// realtime thread can reach is lock-free.
+class Simulator {
+
+  public:
+
+    static const int NUM_PINS = 64;
+
+    struct PinState {
+      std::atomic<bool> high;
+      std::atomic<uint32_t> writes;
+      std::atomic<uint32_t> risingEdges;
+      std::atomic<int64_t> lastWriteNanos;  // steady clock
+    };
+
+    struct MidiSink {
+      std::atomic<uint32_t> clocks;
+      std::atomic<uint32_t> starts;
+      std::atomic<uint32_t> stops;
+      std::atomic<uint32_t> other;
+      std::atomic<int64_t> lastClockNanos;  // steady clock
+    };
+
+    static Simulator &Get();
+
+    void WritePin(int address, bool high);
+    bool ReadPin(int address);
+
+    // Drive a simulated input pin, e.g. the expander interrupt line
+    void SetPin(int address, bool high);
+
+    const PinState &GetPin(int address) const;
+
+    // Register file for a bus and device address, created on first use
+    SimulatedRegisters *OpenI2CDevice(uint8_t bus, uint8_t devAddr);
+
+    // Counts one I2C transaction on a simulated device
+    void CountI2CTransfer() { m_deviceCalls++; }
+
+    void SendMidi(const std::vector<unsigned char> &message);
+    const MidiSink &GetMidiSink() const { return m_midiSink; }
+
+    // Pin, I2C and MIDI operations so far. Each one would have been
+    // at least one syscall on the real device.
+    uint64_t GetDeviceCalls() const { return m_deviceCalls.load(); }
+
+  private:
+
+    Simulator();
+
+    PinState &pin(int address);
+
+    PinState m_pins[NUM_PINS];
+    PinState m_invalidPin;
+    MidiSink m_midiSink;
+    std::atomic<uint64_t> m_deviceCalls;
+
+    std::mutex m_devicesMutex;
+    std::map<int, std::unique_ptr<SimulatedRegisters>> m_devices;
+};
+
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace MissingLink {
+
+// Lock-free ring buffer for exactly one producer thread and one consumer
+// thread. Neither side ever blocks or allocates. Capacity must be a power of two.
+template <typename T, std::size_t Capacity>
+class SPSCQueue {
+
+  static_assert((Capacity & (Capacity - 1)) == 0, "SPSCQueue capacity must be a power of two");
+
+  public:
+
+    SPSCQueue() : m_head(0), m_tail(0) {}
+
+    // Producer only. Returns false if the queue is full.
+    bool Push(const T &item) {
+      const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+      if (tail - m_head.load(std::memory_order_acquire) >= Capacity) {
+        return false;
+      }
+      m_items[tail & (Capacity - 1)] = item;
+      m_tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Consumer only. Returns nullptr if the queue is empty.
+    // The pointer stays valid until the next Pop().
+    const T *Peek() const {
+      const std::size_t head = m_head.load(std::memory_order_relaxed);
+      if (head == m_tail.load(std::memory_order_acquire)) {
+        return nullptr;
+      }
+      return &m_items[head & (Capacity - 1)];
+    }
+
+    // Consumer only. Returns false if the queue is empty.
+    bool Pop(T &item) {
+      const std::size_t head = m_head.load(std::memory_order_relaxed);
+      if (head == m_tail.load(std::memory_order_acquire)) {
+        return false;
+      }
+      item = m_items[head & (Capacity - 1)];
+      m_head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Approximate when called from a thread that is neither side
+    bool IsEmpty() const {
+      return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+  private:
+
+    std::atomic<std::size_t> m_head;  // next slot to read, written by consumer
+    std::atomic<std::size_t> m_tail;  // next slot to write, written by producer
+    T m_items[Capacity];
+};
+
+}
@@ -1,12 +1,45 @@
 // system_info.cpp
 #include <string>
-//#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
 #include <iostream>
+#include <unistd.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include "missing_link/system_info.hpp"
 
 using namespace MissingLink;
 
+namespace MissingLink {
+
+  static void addAddress(std::vector<uint32_t> &addresses, uint32_t address) {
+    if (std::find(addresses.begin(), addresses.end(), address) == addresses.end()) {
+      addresses.push_back(address);
+    }
+  }
+
+  static void removeAddress(std::map<std::string, std::vector<uint32_t>> &interfaces, const std::string &name, uint32_t address) {
+    auto it = interfaces.find(name);
+    if (it == interfaces.end()) { return; }
+    auto &addresses = it->second;
+    addresses.erase(std::remove(addresses.begin(), addresses.end(), address), addresses.end());
+    if (addresses.empty()) {
+      interfaces.erase(it);
+    }
+  }
+
+}
+
 SysInfo::SysInfo()
+  : m_fd(-1)
+  , m_sequence(0)
+  , m_dumpSequence(0)
+  , m_redump(false)
+  , m_published(std::unique_ptr<AddressMap>(new AddressMap()))
 {
   open();
 }
@@ -15,51 +48,159 @@ SysInfo::~SysInfo() {
   close();
 }
 
-std::string SysInfo::GetIP() {
-  bool foundWlan = false;
-  FILE * fp = popen("ifconfig wlan0", "r");
-  std::string result = "000.000.000.000";
-  std::string line;
-  if (fp) {
-    char *p=NULL; size_t n;
-    while ((getline(&p, &n, fp) > 0) && p) {
-      line = (std::string)p;
-      if (line.find("inet ") != std::string::npos) {
-        int start = line.find("inet ") + 5;
-        int stop = line.find(" netmask") - start;
-        result = line.substr(line.find("inet ") + 5, stop);
-        std::cout << "WLAN IP: " + result << std::endl;
-        foundWlan = true;
-        break;
+std::string SysInfo::GetIP() const {
+  uint32_t address = GetAddress("wlan0");
+  if (address == 0) {
+    address = GetAddress("uap0");
+  }
+  if (address == 0) {
+    return "000.000.000.000";
+  }
+  char text[INET_ADDRSTRLEN];
+  in_addr addr;
+  addr.s_addr = address;
+  ::inet_ntop(AF_INET, &addr, text, sizeof(text));
+  return std::string(text);
+}
+
+uint32_t SysInfo::GetAddress(const std::string &interface) const {
+  RcuPointer<AddressMap>::ReadLock addresses(m_published);
+  auto it = addresses->find(interface);
+  return it == addresses->end() ? 0 : it->second;
+}
+
+bool SysInfo::ProcessEvents() {
+  if (m_fd < 0) { return false; }
+
+  char buffer[8192];
+  ssize_t length;
+  while (true) {
+    length = ::recv(m_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (length < 0 && errno == ENOBUFS) {
+      // The socket overflowed and notifications were lost, so the cache
+      // may be missing changes. Only a fresh dump can tell.
+      if (m_dumpSequence != 0) {
+        m_redump = true;
+      } else {
+        requestAddresses();
       }
+      continue;
     }
-    pclose(fp);
-  }
-  if (foundWlan == false) {
-    fp = popen("ifconfig uap0", "r");
-    if (fp) {
-      char *p=NULL; size_t n;
-      while ((getline(&p, &n, fp) > 0) && p) {
-        line = (std::string)p;
-        if (line.find("inet ") != std::string::npos) {
-          int start = line.find("inet ") + 5;
-          int stop = line.find(" netmask") - start;
-          result = line.substr(line.find("inet ") + 5, stop);
-          std::cout << "WLAN IP: " + result << std::endl;
-          foundWlan = true;
-          break;
+    if (length <= 0) { break; }
+
+    for (nlmsghdr *msg = reinterpret_cast<nlmsghdr*>(buffer); NLMSG_OK(msg, (unsigned int)length); msg = NLMSG_NEXT(msg, length)) {
+      // Notifications carry sequence number 0, dump replies the request's
+      const bool dumpReply = m_dumpSequence != 0 && msg->nlmsg_seq == m_dumpSequence;
+      if (msg->nlmsg_type == NLMSG_DONE || msg->nlmsg_type == NLMSG_ERROR) {
+        if (dumpReply) {
+          finishDump(msg->nlmsg_type == NLMSG_DONE);
+        }
+        continue;
+      }
+      if (msg->nlmsg_type != RTM_NEWADDR && msg->nlmsg_type != RTM_DELADDR) { continue; }
+
+      const ifaddrmsg *ifa = static_cast<const ifaddrmsg*>(NLMSG_DATA(msg));
+      if (ifa->ifa_family != AF_INET) { continue; }
+
+      std::string name;
+      uint32_t address = 0;
+      int attrLength = IFA_PAYLOAD(msg);
+      for (const rtattr *attr = IFA_RTA(ifa); RTA_OK(attr, attrLength); attr = RTA_NEXT(attr, attrLength)) {
+        if (attr->rta_type == IFA_LOCAL || (attr->rta_type == IFA_ADDRESS && address == 0)) {
+          std::memcpy(&address, RTA_DATA(attr), sizeof(address));
+        } else if (attr->rta_type == IFA_LABEL) {
+          name = static_cast<const char*>(RTA_DATA(attr));
         }
       }
-      pclose(fp);
+      if (name.empty()) {
+        char ifName[IF_NAMESIZE];
+        if (::if_indextoname(ifa->ifa_index, ifName) == nullptr) { continue; }
+        name = ifName;
+      }
+
+      // Notifications during a dump may be about addresses it already
+      // went past, so they go into both
+      if (dumpReply) {
+        addAddress(m_dumped[name], address);
+      } else if (msg->nlmsg_type == RTM_NEWADDR) {
+        addAddress(m_interfaces[name], address);
+        if (m_dumpSequence != 0) { addAddress(m_dumped[name], address); }
+      } else {
+        removeAddress(m_interfaces, name, address);
+        if (m_dumpSequence != 0) { removeAddress(m_dumped, name, address); }
+      }
     }
   }
-  return result;
+
+  AddressMap addresses;
+  for (const auto &interface : m_interfaces) {
+    addresses[interface.first] = interface.second.front();
+  }
+  if (addresses == m_addresses) {
+    return false;
+  }
+  m_addresses = addresses;
+  m_published.Publish(std::unique_ptr<AddressMap>(new AddressMap(m_addresses)));
+  std::cout << "WLAN IP: " + GetIP() << std::endl;
+  return true;
+}
+
+void SysInfo::finishDump(bool complete) {
+  if (complete) {
+    m_interfaces.swap(m_dumped);
+  } else {
+    std::cerr << "Address dump failed" << std::endl;
+  }
+  m_dumped.clear();
+  m_dumpSequence = 0;
+  if (m_redump) {
+    m_redump = false;
+    requestAddresses();
+  }
 }
 
 void SysInfo::open() {
-  // do something?
+  m_fd = ::socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (m_fd < 0) {
+    std::cerr << "Failed to open netlink socket: " << std::strerror(errno) << std::endl;
+    return;
+  }
+  sockaddr_nl local;
+  std::memset(&local, 0, sizeof(local));
+  local.nl_family = AF_NETLINK;
+  local.nl_groups = RTMGRP_IPV4_IFADDR;
+  if (::bind(m_fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) < 0) {
+    std::cerr << "Failed to bind netlink socket: " << std::strerror(errno) << std::endl;
+    close();
+    return;
+  }
+  requestAddresses();
 }
 
 void SysInfo::close() {
-  //maybe do something?
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+}
+
+void SysInfo::requestAddresses() {
+  // Dump the current addresses, the replies arrive like notifications
+  struct {
+    nlmsghdr header;
+    ifaddrmsg message;
+  } request;
+  std::memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(ifaddrmsg));
+  request.header.nlmsg_type = RTM_GETADDR;
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  if (++m_sequence == 0) { m_sequence = 1; }
+  request.header.nlmsg_seq = m_sequence;
+  request.message.ifa_family = AF_INET;
+  if (::send(m_fd, &request, request.header.nlmsg_len, 0) < 0) {
+    std::cerr << "Failed to request addresses: " << std::strerror(errno) << std::endl;
+    return;
+  }
+  m_dumped.clear();
+  m_dumpSequence = request.header.nlmsg_seq;
 }
@@ -1,7 +1,15 @@
 #include <cstdlib>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "missing_link/rcu_pointer.hpp"
 
 namespace MissingLink {
 
+// Keeps the IPv4 addresses of the network interfaces, following rtnetlink
+// address notifications instead of asking ifconfig. Lookups from any
+// thread only read the cache.
 class SysInfo {
 
   public:
@@ -9,12 +17,37 @@ class SysInfo {
     SysInfo();
     virtual ~SysInfo();
 
-    std::string GetIP();
+    // Address of wlan0, or of uap0 in access point mode
+    std::string GetIP() const;
+
+    // Address of the given interface, 0 if it has none. Network byte order.
+    uint32_t GetAddress(const std::string &interface) const;
+
+    // Netlink socket to watch for readability, -1 if it couldn't be opened
+    int GetFd() const { return m_fd; }
+
+    // Read pending notifications into the cache. Never blocks.
+    // Returns true if an address changed.
+    bool ProcessEvents();
 
   protected:
 
+    typedef std::map<std::string, uint32_t> AddressMap;
+    typedef std::map<std::string, std::vector<uint32_t>> InterfaceMap;
+
+    int m_fd;
+    InterfaceMap m_interfaces;        // every address of every interface, oldest first
+    InterfaceMap m_dumped;            // dump in progress, replaces m_interfaces once complete
+    uint32_t m_sequence;
+    uint32_t m_dumpSequence;          // of the dump in progress, 0 if there is none
+    bool m_redump;                    // notifications were lost during the dump
+    AddressMap m_addresses;           // writer's copy of the first address of each interface
+    RcuPointer<AddressMap> m_published;
+
     void open();
     void close();
+    void requestAddresses();
+    void finishDump(bool complete);
 
 };
 
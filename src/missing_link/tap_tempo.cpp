@@ -3,37 +3,172 @@
  * Circuit Happy, LLC
  */
 
-#include <iostream>
+#include <algorithm>
+#include <cmath>
 #include "missing_link/tap_tempo.hpp"
 
 using namespace std::chrono;
 using namespace MissingLink;
 
-TapTempo::TapTempo() : m_tapCount(0) {}
+namespace MissingLink {
+
+  // A pause this long starts a new run of taps
+  static const microseconds TapTimeout(1500000);
+
+  // Taps closer than this are bounce, 400 BPM
+  static const microseconds MinTapInterval(150000);
+
+  // A tap off the fitted line by more than this fraction of a beat, or
+  // the minimum for fast tempos, is an outlier
+  static const double TapOutlierFraction = 0.1;
+  static const microseconds MinTapOutlierError(30000);
+
+  // Gaps of up to this many beats are taken as skipped taps
+  static const int MaxSkippedBeats = 2;
+
+  static const int MinTapWindow = 2;
+  static const int MaxTapWindow = 16;
+
+}
+
+TapTempo::TapTempo()
+  : m_options{6, false}
+  , m_lastTap(0)
+  , m_outlier(0)
+  , m_outliers(0)
+  , m_lastSteps(1)
+  , m_origin(0.0)
+  , m_period(0.0)
+{}
 
 TapTempo::~TapTempo() {}
 
-void TapTempo::Tap() {
-  const auto now = steady_clock::now();
-  const auto intervalSinceLast = now - m_previousTapTime;
+void TapTempo::SetOptions(const Options &options) {
+  m_options = options;
+  m_options.window = std::max(MinTapWindow, std::min(MaxTapWindow, options.window));
+}
 
-  // If more than 1.5 seconds have gone by since last tap, reset
-  if (m_tapCount == 0 || intervalSinceLast >= milliseconds(1500)) {
-    m_tapCount = 1;
-    m_startTapTime = now;
-    m_previousTapTime = now;
+void TapTempo::Tap(microseconds time) {
+  const auto interval = time - m_lastTap;
+  if (m_samples.empty() || interval >= TapTimeout || interval < microseconds(0)) {
+    restart(time);
+    return;
+  }
+  if (interval < MinTapInterval) {
+    return;
+  }
+  m_lastTap = time;
+
+  if (m_samples.size() == 1) {
+    m_samples.push_back({1, time});
+    fit();
+    report();
     return;
   }
 
-  m_tapCount += 1;
+  // Which beat this is, allowing for skipped ones
+  const Sample &last = m_samples.back();
+  const double beats = (double)(time - last.time).count() / m_period;
+  const long long steps = std::max(1LL, (long long)std::llround(beats));
+  const long long beat = last.beat + steps;
+  const double error = (double)time.count() - (m_origin + m_period * beat);
 
-  const auto totalInterval = now - m_startTapTime;
-  const auto averageInterval = totalInterval / (double)(m_tapCount - 1);
-  const double newTempo = (int)((seconds(60)/averageInterval) + 0.5);
+  const double tolerance = std::max(TapOutlierFraction * m_period, (double)MinTapOutlierError.count());
+  if (beats > MaxSkippedBeats + 0.5 || std::fabs(error) > tolerance) {
+    if (m_outliers > 0 && inStep(last.time, m_outlier, time)) {
+      // Two in a row off the line but in step with each other, the
+      // tempo changed. Start over from them.
+      const auto outlier = m_outlier;
+      restart(outlier);
+      m_lastTap = time;
+      m_samples.push_back({1, time});
+      fit();
+      report();
+      return;
+    }
+    // Unrelated stray taps, only the newer one may still start a new tempo
+    m_outlier = time;
+    m_outliers = 1;
+    return;
+  }
+  m_outliers = 0;
 
-  if (onNewTempo) {
-    onNewTempo(newTempo);
+  if (steps > 1 && steps == m_lastSteps) {
+    // Skipping the same beats again, the taps are on a slower tempo, e.g.
+    // half time, not missing beats of this one. Start over from the last
+    // two, as for a tempo change.
+    const auto lastTime = last.time;
+    restart(lastTime);
+    m_lastTap = time;
+    m_samples.push_back({1, time});
+    fit();
+    report();
+    return;
+  }
+  m_lastSteps = steps;
+
+  m_samples.push_back({beat, time});
+  while ((int)m_samples.size() > m_options.window) {
+    m_samples.pop_front();
   }
+  fit();
+  report();
+}
+
+bool TapTempo::inStep(microseconds lastTime, microseconds outlier, microseconds time) const {
+  // The interval between the two outliers has to be a tap interval, and
+  // the first outlier a whole number of those after the last good tap, as
+  // if the tempo changed right after it
+  const double interval = (double)(time - outlier).count();
+  if (interval < (double)MinTapInterval.count() || interval >= (double)TapTimeout.count()) {
+    return false;
+  }
+  const double beats = (double)(outlier - lastTime).count() / interval;
+  const double steps = std::max(1.0, std::round(beats));
+  const double error = std::fabs((double)(outlier - lastTime).count() - steps * interval);
+  const double tolerance = std::max(TapOutlierFraction * interval, (double)MinTapOutlierError.count());
+  return steps <= MaxSkippedBeats && error <= tolerance;
+}
+
+void TapTempo::restart(microseconds time) {
+  m_samples.clear();
+  m_samples.push_back({0, time});
+  m_lastTap = time;
+  m_outliers = 0;
+  m_lastSteps = 1;
+}
 
-  m_previousTapTime = now;
+void TapTempo::fit() {
+  // Relative to the first sample, microseconds since boot squared lose precision
+  const Sample &first = m_samples.front();
+  const double n = (double)m_samples.size();
+  double sumX = 0.0, sumY = 0.0, sumXX = 0.0, sumXY = 0.0;
+  for (const auto &sample : m_samples) {
+    const double x = (double)(sample.beat - first.beat);
+    const double y = (double)(sample.time - first.time).count();
+    sumX += x;
+    sumY += y;
+    sumXX += x * x;
+    sumXY += x * y;
+  }
+  const double denominator = n * sumXX - sumX * sumX;
+  if (denominator <= 0.0) { return; }
+
+  m_period = (n * sumXY - sumX * sumY) / denominator;
+  const double intercept = (sumY - m_period * sumX) / n;
+  m_origin = (double)first.time.count() + intercept - m_period * first.beat;
+}
+
+void TapTempo::report() {
+  if (m_period <= 0.0) { return; }
+
+  const double tempo = 60.0e6 / m_period;
+  const double resolution = m_options.wholeBpm ? 1.0 : 10.0;
+  if (onNewTempo) {
+    onNewTempo(std::round(tempo * resolution) / resolution);
+  }
+  if (onBeat) {
+    const double beatTime = m_origin + m_period * m_samples.back().beat;
+    onBeat(microseconds((long long)std::llround(beatTime)));
+  }
 }
@@ -3,29 +3,67 @@
  * Circuit Happy, LLC
  */
 
+#pragma once
+
 #include <chrono>
+#include <deque>
 #include <functional>
 
 namespace MissingLink {
 
+// Tempo from tapping along. A line is fitted through the latest taps by
+// least squares, tap number against time, so every tap counts the same
+// and a single late one barely moves it. Taps far off the line are
+// dropped unless the next one agrees with them, then the tempo changed
+// and the fit starts over. A skipped beat is taken as such, but two taps
+// in a row skipping the same number of beats are a slower tempo.
 class TapTempo {
 
 public:
 
+  struct Options {
+    int window;       // taps fitted, more is steadier, fewer follows changes faster
+    bool wholeBpm;    // round the tempo to whole BPM instead of tenths
+  };
+
   TapTempo();
   virtual ~TapTempo();
 
-  void Tap();
+  void SetOptions(const Options &options);
+
+  // time is the host time of the tap
+  void Tap(std::chrono::microseconds time);
 
+  // Estimated tempo, from the second tap on
   std::function<void(double)> onNewTempo;
 
+  // Host time of the latest tap's beat according to the fit, after onNewTempo
+  std::function<void(std::chrono::microseconds)> onBeat;
+
 private:
 
-  typedef std::chrono::time_point<std::chrono::steady_clock> timestamp;
+  struct Sample {
+    long long beat;
+    std::chrono::microseconds time;
+  };
+
+  void restart(std::chrono::microseconds time);
+  // True if two outliers after the last good tap look like a new tempo
+  bool inStep(std::chrono::microseconds lastTime, std::chrono::microseconds outlier,
+              std::chrono::microseconds time) const;
+  void fit();
+  void report();
+
+  Options m_options;
+  std::deque<Sample> m_samples;
+  std::chrono::microseconds m_lastTap;
+  std::chrono::microseconds m_outlier;  // rejected tap, if m_outliers > 0
+  int m_outliers;
+  long long m_lastSteps;                // beats the last accepted tap came after
 
-  int m_tapCount;
-  timestamp m_startTapTime;
-  timestamp m_previousTapTime;
+  // Line through the samples: time = m_origin + m_period * beat
+  double m_origin;    // us
+  double m_period;    // us per beat
 
 };
 
@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "missing_link/tempo_tracker.hpp"
+
+using namespace MissingLink;
+
+namespace MissingLink {
+
+  // Filter memory once settled, in ticks. Longer is smoother but slower to follow changes.
+  static const int TrackerMemory = 192;
+
+  // Clock needed before the estimate is used, a beat of it but at least a
+  // few ticks for slow clocks like one pulse per beat
+  static const int TrackerLockBeats = 1;
+  static const int MinLockTicks = 4;
+
+  // A tick off its prediction by more than this fraction of a period is an outlier
+  static const double OutlierFraction = 0.3;
+
+  // This many outliers in a row means the tempo jumped, start over
+  static const int MaxOutliers = 4;
+
+  // Smoothing of the short term period, taken straight from tick intervals
+  static const double ShortPeriodSmoothing = 0.125;
+
+  // A short term period this far off the estimate means the tempo is
+  // moving rather than jittering, shorten the memory to catch up
+  static const double MaxPeriodDeviation = 0.04;
+
+  // Memory the filter drops back to when the tempo moves
+  static const int RelockSamples = 4;
+
+  // Gaps of up to this many periods are taken as dropped ticks
+  static const int MaxSkippedTicks = 4;
+
+  // Accepted tempo range
+  static const double MinTrackedTempo = 10.0;
+  static const double MaxTrackedTempo = 999.0;
+
+}
+
+TempoTracker::TempoTracker(int ticksPerBeat)
+  : m_ticksPerBeat(ticksPerBeat)
+  , m_lockTicks(std::max(MinLockTicks, TrackerLockBeats * ticksPerBeat))
+  , m_tick(-1)
+{
+  Reset();
+}
+
+void TempoTracker::Reset() {
+  m_samples = 0;
+  m_locked = false;
+  m_outliers = 0;
+  m_shortPeriod = 0.0;
+  m_lastTime = 0.0;
+  m_intervals[0] = m_intervals[1] = m_intervals[2] = 0.0;
+  m_tickTime = 0.0;
+  m_period = 0.0;
+}
+
+bool TempoTracker::Tick(std::chrono::microseconds time) {
+  const double t = (double)time.count();
+
+  const double lastTime = m_lastTime;
+  m_lastTime = t;
+
+  if (m_samples == 0) {
+    m_tickTime = t;
+    m_tick++;
+    m_samples = 1;
+    return true;
+  }
+
+  if (m_samples == 1) {
+    const double period = t - m_tickTime;
+    const double tempo = 60.0e6 / (period * m_ticksPerBeat);
+    m_tick++;
+    m_tickTime = t;
+    if (period <= 0.0 || tempo < MinTrackedTempo || tempo > MaxTrackedTempo) {
+      // Start over from this tick
+      return false;
+    }
+    m_period = period;
+    m_shortPeriod = period;
+    m_intervals[0] = m_intervals[1] = m_intervals[2] = period;
+    m_samples = 2;
+    return true;
+  }
+
+  // Allow for ticks lost on the way
+  const int elapsed = (int)std::lround((t - m_tickTime) / m_period);
+  const int ticks = std::min(MaxSkippedTicks, std::max(1, elapsed));
+
+  // Short term period from the raw intervals, median of three so a single
+  // late tick doesn't move it
+  m_intervals[0] = m_intervals[1];
+  m_intervals[1] = m_intervals[2];
+  m_intervals[2] = (t - lastTime) / std::max(1, (int)std::lround((t - lastTime) / m_period));
+  const double median = std::max(std::min(m_intervals[0], m_intervals[1]),
+      std::min(std::max(m_intervals[0], m_intervals[1]), m_intervals[2]));
+  m_shortPeriod += ShortPeriodSmoothing * (median - m_shortPeriod);
+
+  if (m_samples > RelockSamples && std::fabs(m_shortPeriod / m_period - 1.0) > MaxPeriodDeviation) {
+    // Follow the new tempo with a short memory, from the latest tick
+    m_period = m_shortPeriod;
+    m_tickTime = t;
+    m_tick += std::max(1, (int)std::lround((t - lastTime) / m_period));
+    // Still locked, the estimate only moved
+    m_samples = RelockSamples;
+    m_outliers = 0;
+    return true;
+  }
+  const double predicted = m_tickTime + ticks * m_period;
+  const double error = t - predicted;
+
+  if (std::fabs(error) > OutlierFraction * m_period || elapsed > MaxSkippedTicks) {
+    if (++m_outliers >= MaxOutliers) {
+      // Not noise, the clock changed. Relock starting from this tick.
+      m_outliers = 0;
+      m_tick += std::max(1, elapsed);
+      m_tickTime = t;
+      if (m_locked) {
+        // From the latest intervals, which already have the new tempo
+        m_period = median;
+        m_shortPeriod = median;
+        m_samples = RelockSamples;
+      } else {
+        m_samples = 1;
+      }
+    }
+    return false;
+  }
+  m_outliers = 0;
+
+  // Growing memory alpha-beta gains, equivalent to a least squares line fit
+  // over all samples, until the memory cap fixes them
+  const double k = (double)std::min(m_samples + 1, TrackerMemory);
+  const double alpha = 2.0 * (2.0 * k - 1.0) / (k * (k + 1.0));
+  const double beta = 6.0 / (k * (k + 1.0));
+
+  m_tickTime = predicted + alpha * error;
+  m_period += beta * error / ticks;
+  m_tick += ticks;
+  m_samples++;
+  if (m_samples >= m_lockTicks) {
+    m_locked = true;
+  }
+  return true;
+}
+
+void TempoTracker::SetNextTick(long long tick) {
+  m_tick = tick - 1;
+}
+
+bool TempoTracker::IsLocked() const {
+  return m_locked;
+}
+
+double TempoTracker::GetTempo() const {
+  if (m_period <= 0.0) { return 0.0; }
+  return 60.0e6 / (m_period * m_ticksPerBeat);
+}
+
+std::chrono::microseconds TempoTracker::GetTickTime() const {
+  return std::chrono::microseconds((long long)std::llround(m_tickTime));
+}
+
+double TempoTracker::GetBeat() const {
+  return (double)m_tick / (double)m_ticksPerBeat;
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) 2018
+ * Circuit Happy, LLC
+ */
+
+#pragma once
+
+#include <chrono>
+
+namespace MissingLink {
+
+/// Smoothed tempo and phase of a followed clock source
+struct ExternalClock {
+  double tempo;
+  double beat;                      // beats since start or song position...
+  bool positioned;                  // ...only meaningful if the source sent one
+  int ticksPerBeat;                 // otherwise only the tick grid is followed
+  std::chrono::microseconds time;   // host time of that beat
+};
+
+// Phase locked tempo estimate from a stream of timestamped clock ticks,
+// e.g. 24 PPQN MIDI clock. Each tick is predicted from the current phase
+// and period estimate and the prediction error is fed back into both
+// (an alpha-beta filter). The gains start out as a least squares fit over
+// all ticks so far, so it locks within a couple of beats, and settle to a
+// fixed memory of a few beats so jitter barely moves the tempo.
+// Ticks far off the prediction are dropped as outliers, unless enough of
+// them arrive in a row to mean the tempo really changed. A short term
+// period taken straight from the tick intervals catches tempo changes and
+// shortens the memory again so they are followed quickly.
+class TempoTracker {
+
+  public:
+
+    TempoTracker(int ticksPerBeat);
+
+    // Forget everything, e.g. when the clock source goes away
+    void Reset();
+
+    // Feed one tick at the given host time. Returns false if it was rejected.
+    bool Tick(std::chrono::microseconds time);
+
+    // Number the next tick, e.g. 0 after a MIDI start or from a song position
+    void SetNextTick(long long tick);
+
+    // True once enough ticks went into the estimate to trust it
+    bool IsLocked() const;
+
+    double GetTempo() const;
+
+    // Filtered time and beat of the latest tick
+    std::chrono::microseconds GetTickTime() const;
+    double GetBeat() const;
+
+  private:
+
+    const int m_ticksPerBeat;
+    const int m_lockTicks;  // ticks in the estimate before it is first used
+
+    int m_samples;          // ticks in the estimate, caps the filter memory
+    bool m_locked;          // kept while the estimate follows a moving tempo
+    int m_outliers;         // consecutive rejected ticks
+    double m_shortPeriod;   // lightly smoothed period straight from tick intervals
+    double m_lastTime;      // raw time of the latest tick, in us
+    double m_intervals[3];  // latest raw tick intervals
+    long long m_tick;       // index of the latest tick
+    double m_tickTime;      // filtered host time of the latest tick, in us
+    double m_period;        // us per tick
+};
+
+}
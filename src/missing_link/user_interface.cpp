@@ -6,6 +6,7 @@
 #include <iostream>
 #include <iomanip>
 #include <vector>
+#include <sys/epoll.h>
 
 #include "missing_link/hw_defs.h"
 #include "missing_link/engine.hpp"
@@ -40,17 +41,35 @@ namespace MissingLink {
     .pullUpEnabled  = 0b00011111,
     .intConfig      = ExpanderIntConfig
   };
+
+  // Expander reads per wakeup while the interrupt line stays low
+  static const int MaxInterruptPasses = 4;
+
+  // Retry delay when the line is still low after that
+  static const std::chrono::milliseconds InterruptRetryDelay(10);
 }
 
-UserInputProcess::UserInputProcess(Engine &engine)
-  : Engine::Process(engine, std::chrono::microseconds(10))
-  , m_pExpander(shared_ptr<IOExpander>(new IOExpander()))
-  , m_pInterruptIn(unique_ptr<Pin>(new Pin(ML_INTERRUPT_PIN, Pin::IN)))
+UserInput::UserInput(Reactor &reactor, HostClock hostClock, shared_ptr<InputStats> pStats,
+                     shared_ptr<IOExpander> pExpander)
+  : m_reactor(reactor)
+  , m_hostClock(hostClock)
+  , m_pStats(pStats)
+  , m_retryTimer(-1)
+  , m_pExpander(pExpander)
+  , m_pInterruptEvents(unique_ptr<LineEvents>(new LineEvents(ML_GPIO_CHIP, ML_INTERRUPT_PIN, Pin::FALLING)))
+  , m_eventClock(hostClock)
+  , m_edgeTime(0)
+  , m_edgePending(false)
+  , m_interruptTime(0)
+  , m_readDone(0)
   , m_encoderButtonDown(false)
 {
-  // Configure interrupt pin and clear initial interrupt
-  m_pInterruptIn->SetEdgeMode(Pin::FALLING);
-  m_pInterruptIn->Read();
+  if (!m_pInterruptEvents->IsOpen()) {
+    // Configure interrupt pin and clear initial interrupt
+    m_pInterruptIn = unique_ptr<Pin>(new Pin(ML_INTERRUPT_PIN, Pin::IN));
+    m_pInterruptIn->SetEdgeMode(Pin::FALLING);
+    m_pInterruptIn->Read();
+  }
 
   // Configure Expander
   m_pExpander->Configure(ExpanderConfig);
@@ -60,78 +79,128 @@ UserInputProcess::UserInputProcess(Engine &engine)
 
   // Register handlers
   auto playButton = unique_ptr<Button>(new Button(PLAY_BUTTON));
-  playButton->onButtonDown = [=]() {
-    if (m_encoderButtonDown) {
-      if (onEncoderAndPlay) { onEncoderAndPlay(); }
-    } else {
-      if (onPlayStop) { onPlayStop(); }
-    }
+  playButton->onButtonDown = [=](std::chrono::microseconds time) {
+    dispatch([=]() {
+      if (m_encoderButtonDown) {
+        if (onEncoderAndPlay) { onEncoderAndPlay(time); }
+      } else {
+        if (onPlayStop) { onPlayStop(time); }
+      }
+    });
   };
   m_controls.push_back(std::move(playButton));
 
   auto tapButton = unique_ptr<Button>(new Button(TAP_BUTTON));
-  tapButton->onButtonDown = [=]() {
-    if (m_encoderButtonDown) {
-      if (onEncoderAndTap) { onEncoderAndTap(); }
-    } else {
-      if (onTapTempo) { onTapTempo(); }
-    }
+  tapButton->onButtonDown = [=](std::chrono::microseconds time) {
+    dispatch([=]() {
+      if (m_encoderButtonDown) {
+        if (onEncoderAndTap) { onEncoderAndTap(time); }
+      } else {
+        if (onTapTempo) { onTapTempo(time); }
+      }
+    });
   };
   m_controls.push_back(std::move(tapButton));
 
   auto encoderButton = unique_ptr<Button>(new Button(ENC_BUTTON));
-  encoderButton->onButtonDown = [=]() {
+  encoderButton->onButtonDown = [=](std::chrono::microseconds time) {
     m_encoderButtonDown = true;
-    if (onEncoderPress) { onEncoderPress(); }
+    dispatch([=]() {
+      if (onEncoderPress) { onEncoderPress(time); }
+    });
   };
-  encoderButton->onButtonUp = [=]() {
+  encoderButton->onButtonUp = [=](std::chrono::microseconds) {
     m_encoderButtonDown = false;
   };
   m_controls.push_back(std::move(encoderButton));
 
   auto encoder = unique_ptr<RotaryEncoder>(new RotaryEncoder(ENC_A, ENC_B));
   encoder->onRotated = [=](float amount) {
-    if (onEncoderRotate && !m_encoderButtonDown) { onEncoderRotate(amount); }
+    if (onEncoderRotate && !m_encoderButtonDown) {
+      dispatch([=]() { onEncoderRotate(amount); });
+    }
   };
   m_controls.push_back(std::move(encoder));
-}
 
-void UserInputProcess::process() {
-  pollfd pfd = m_pInterruptIn->GetPollInfo();
+  m_retryTimer = m_reactor.AddTimer([this]() { onInterrupt(); });
+  // sysfs signals an edge as an exceptional condition on the value file
+  const uint32_t events = m_pInterruptEvents->IsOpen() ? EPOLLIN : EPOLLPRI | EPOLLERR;
+  m_reactor.Watch(interruptFd(), events, [this](uint32_t) { onInterrupt(); });
 
-  // If interrupt is already low, handle immediately
-  if (m_pInterruptIn->Read() == GPIO::LOW) {
-    handleInterrupt();
-    if (++m_loopGuardCount > 10) {
-      m_loopGuardCount = 0;
-      std::cerr << "UI process in tight loop. Forcing 10ms sleep..." << std::endl;
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
-    return;
+  // The line may already be low from before we were listening
+  if (interruptIsActive()) {
+    m_reactor.SetTimer(m_retryTimer, InterruptRetryDelay);
   }
+}
 
-  m_loopGuardCount = 0;
+UserInput::~UserInput() {
+  // The reactor outlives us, and must not call into us or close our fd
+  m_reactor.Unwatch(interruptFd());
+  m_reactor.RemoveTimer(m_retryTimer);
+}
 
-  // Poll for 500ms
-  int result = ::poll(&pfd, 1, 500);
+int UserInput::interruptFd() {
+  if (m_pInterruptEvents->IsOpen()) {
+    return m_pInterruptEvents->GetPollInfo().fd;
+  }
+  return m_pInterruptIn->GetPollInfo().fd;
+}
 
-  // No interrupts? try again
-  if (result == 0) { return; }
+void UserInput::onInterrupt() {
+  // The latest edge is when the expander saw the change. Without line
+  // events, when we woke up is as close as it gets.
+  std::chrono::nanoseconds timestamp;
+  bool rising;
+  while (m_pInterruptEvents->Read(timestamp, rising)) {
+    m_edgeTime = m_eventClock.ToHostTime(timestamp);
+    m_edgePending = true;
+  }
+  if (m_edgePending) {
+    m_pStats->wakeup.Record(m_hostClock() - m_edgeTime);
+  }
 
-  // Handle it
-  handleInterrupt();
+  int passes = 0;
+  while (interruptIsActive()) {
+    if (++passes > MaxInterruptPasses) {
+      // Still low, another edge won't come until it is released.
+      // Look again shortly instead of spinning on it.
+      m_reactor.SetTimer(m_retryTimer, InterruptRetryDelay);
+      return;
+    }
+    // Later passes are changes that came in without an edge of their own
+    handleInterrupt(m_edgePending ? m_edgeTime : m_hostClock());
+    m_edgePending = false;
+  }
+}
 
-  // Clear interrupt event
-  m_pInterruptIn->Read();
+bool UserInput::interruptIsActive() {
+  if (m_pInterruptEvents->IsOpen()) {
+    return m_pInterruptEvents->ReadValue() == GPIO::LOW;
+  }
+  // Reading the value also clears the sysfs edge event
+  return m_pInterruptIn->Read() == GPIO::LOW;
 }
 
-void UserInputProcess::handleInterrupt() {
-  uint8_t flag = m_pExpander->ReadInterruptFlag();
-  uint8_t state = m_pExpander->ReadGPIO();
+void UserInput::handleInterrupt(std::chrono::microseconds time) {
+  const auto readStart = m_hostClock();
+  const auto interrupt = m_pExpander->ReadInterrupt();
+  m_readDone = m_hostClock();
+  m_pStats->read.Record(m_readDone - readStart);
+  m_interruptTime = time;
 
   for (auto &control : m_controls) {
-    if (control->CanHandleInterrupt(flag)) {
-      control->HandleInterrupt(flag, state, m_pExpander);
+    if (control->CanHandleInterrupt(interrupt.flag)) {
+      control->HandleInterrupt(interrupt, time, m_pExpander);
     }
   }
 }
+
+void UserInput::dispatch(const std::function<void()> &action) {
+  const auto start = m_hostClock();
+  m_pStats->dispatch.Record(start - m_readDone);
+  m_pStats->ExpectDisplay(m_interruptTime);
+  action();
+  const auto done = m_hostClock();
+  m_pStats->action.Record(done - start);
+  m_pStats->total.Record(done - m_interruptTime);
+}
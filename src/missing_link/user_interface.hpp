@@ -5,42 +5,67 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <functional>
 #include <vector>
 #include "missing_link/gpio.hpp"
 #include "missing_link/control.hpp"
+#include "missing_link/event_clock.hpp"
+#include "missing_link/input_stats.hpp"
 #include "missing_link/io_expander.hpp"
+#include "missing_link/reactor.hpp"
 
 namespace MissingLink {
 
-class UserInputProcess : public Engine::Process {
+// Buttons and encoder, read when the expander raises its interrupt line
+class UserInput {
 
   public:
 
-    UserInputProcess(Engine &engine);
+    UserInput(Reactor &reactor, HostClock hostClock, std::shared_ptr<InputStats> pStats,
+              std::shared_ptr<IOExpander> pExpander);
+    virtual ~UserInput();
 
     // Outputs
-    // These will be called from input polling thread
-    std::function<void()> onPlayStop;
-    std::function<void()> onTapTempo;
-    std::function<void()> onEncoderAndTap;
-    std::function<void()> onEncoderAndPlay;
-    std::function<void()> onEncoderPress;
+    // These will be called from the reactor thread. Buttons pass the host
+    // time they were pressed at, which is before the call.
+    std::function<void(std::chrono::microseconds)> onPlayStop;
+    std::function<void(std::chrono::microseconds)> onTapTempo;
+    std::function<void(std::chrono::microseconds)> onEncoderAndTap;
+    std::function<void(std::chrono::microseconds)> onEncoderAndPlay;
+    std::function<void(std::chrono::microseconds)> onEncoderPress;
     std::function<void(float)> onEncoderRotate;
 
   private:
 
-    void process() override;
-    void handleInterrupt();
+    void onInterrupt();
+    int interruptFd();
+    void handleInterrupt(std::chrono::microseconds time);
+    bool interruptIsActive();
+
+    // Runs an output callback for the interrupt being handled, timing it
+    void dispatch(const std::function<void()> &action);
+
+    Reactor &m_reactor;
+    HostClock m_hostClock;
+    std::shared_ptr<InputStats> m_pStats;
+    int m_retryTimer;
 
     std::vector<std::unique_ptr<Control>> m_controls;
     std::shared_ptr<IOExpander> m_pExpander;
+
+    // Interrupt line events with the kernel's timestamps, or the sysfs
+    // pin where the character device isn't available
+    std::unique_ptr<GPIO::LineEvents> m_pInterruptEvents;
     std::unique_ptr<GPIO::Pin> m_pInterruptIn;
+    EventClock m_eventClock;
+    std::chrono::microseconds m_edgeTime;
+    bool m_edgePending;   // m_edgeTime not yet given to an interrupt read
+    std::chrono::microseconds m_interruptTime;  // of the interrupt being handled
+    std::chrono::microseconds m_readDone;       // when its expander read finished
 
     bool m_encoderButtonDown;
-
-    int m_loopGuardCount = 0;
 };
 
 } // namespace
@@ -5,6 +5,7 @@
 
 #include <chrono>
 #include "missing_link/view.hpp"
+#include "missing_link/animation.hpp"
 #include "missing_link/hw_defs.h"
 #include "missing_link/types.hpp"
 
@@ -16,9 +17,11 @@ namespace MissingLink {
 }
 
 MainView::MainView()
-  : m_pLEDDriver(std::unique_ptr<LEDDriver>(new LEDDriver()))
+  : m_scrollTempMessage(false)
+  , m_pLEDDriver(std::unique_ptr<LEDDriver>(new LEDDriver()))
   , m_pDisplay(std::unique_ptr<SegmentDisplay>(new SegmentDisplay()))
   , m_pLogoLight(std::unique_ptr<Pin>(new Pin(ML_LOGO_PIN, Pin::OUT)))
+  , m_logoLightState(-1)
   , m_addLedBrightness(0)
 {
   m_pLEDDriver->Configure();
@@ -27,9 +30,14 @@ MainView::MainView()
 
 MainView::~MainView() {}
 
-void MainView::SetAnimationLEDs(const float frame[NumAnimLEDs]) {
+void MainView::OnDisplaySent(std::function<void()> handler) {
+  ScopedMutex lock(m_displayMutex);
+  m_pDisplay->onSent = handler;
+}
+
+void MainView::SetAnimationLEDs(const float levels[NumAnimLEDs]) {
   for (int i = 0; i < NumAnimLEDs; i ++) {
-    m_pLEDDriver->SetBrightness(std::min(1.0, frame[i] + m_addLedBrightness), ANIM_LED_START + i);
+    m_pLEDDriver->SetLevel(GammaCorrect(levels[i] + m_addLedBrightness), ANIM_LED_START + i);
   }
   m_addLedBrightness = std::max(0.0, m_addLedBrightness - 0.1);
 }
@@ -53,33 +61,23 @@ void MainView::WriteDisplay(const std::string &string, bool force) {
 void MainView::WriteDisplayTemporarily(const std::string &string, int millis, bool scrolling) {
   ScopedMutex lock(m_displayMutex);
   m_scrollTempMessage = scrolling;
-  if (scrolling) {
-    m_scrollOffset = 0;
-    m_tempScrollingMessage = string;
-  }
   m_tempDisplayValues.push(string);
   m_tempMessageExpiration = Clock::now() + std::chrono::milliseconds(millis);
-  m_pDisplay->Write(string);
+  if (scrolling) {
+    m_marquee.Set(string);
+    m_pDisplay->WriteGlyphs(m_marquee.GetWindow());
+  } else {
+    m_pDisplay->Write(string);
+  }
 }
 
 void MainView::ScrollTempMessage() {
+  ScopedMutex lock(m_displayMutex);
   if (m_scrollTempMessage) {
     auto now = Clock::now();
     if (now >= m_lastTempMessageFrame) {
       m_lastTempMessageFrame = now + std::chrono::milliseconds(150);
-      int messageLength = m_tempScrollingMessage.length();
-      m_scrollOffset ++;
-      if (m_tempScrollingMessage.at(m_scrollOffset) == '.') {
-        m_scrollOffset ++;
-      }
-      if ((m_scrollOffset + 3) > (messageLength - 1)) m_scrollOffset = 0;
-      int charCount = 4;
-      for (int c = 0; c < charCount; c ++) {
-        if (m_tempScrollingMessage.at(c + m_scrollOffset) == '.') {
-          charCount ++;
-        }
-      }
-      m_tempDisplayValues.push(m_tempScrollingMessage.substr(m_scrollOffset, charCount));
+      m_marquee.Advance();
     }
   }
 }
@@ -98,22 +96,30 @@ void MainView::UpdateDisplay() {
     m_pDisplay->Write(m_displayValue);
     return;
   }
-  m_pDisplay->Write(m_tempDisplayValues.top());
+  if (m_scrollTempMessage) {
+    m_pDisplay->WriteGlyphs(m_marquee.GetWindow());
+  } else {
+    m_pDisplay->Write(m_tempDisplayValues.top());
+  }
   if (now >= m_tempMessageExpiration) {
     m_tempDisplayValues = std::stack<std::string>();
     m_scrollTempMessage = false;
   }
 }
 
-void MainView::displayWifiStatusFrame(float frame) {
-  m_pLEDDriver->SetBrightness(frame, WIFI_LED);
+void MainView::displayWifiStatusFrame(float level) {
+  m_pLEDDriver->SetLevel(GammaCorrect(level), WIFI_LED);
+}
+
+void MainView::FlushLEDs() {
+  m_pLEDDriver->Flush();
 }
 
 void MainView::setLogoLight(double phase) {
-  if (phase < 0.75) {
-    m_pLogoLight->Write(HIGH);
-  } else {
-    m_pLogoLight->Write(LOW);
+  const DigitalValue value = phase < 0.75 ? HIGH : LOW;
+  if (value != m_logoLightState) {
+    m_pLogoLight->Write(value);
+    m_logoLightState = value;
   }
 }
 
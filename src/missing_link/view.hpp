@@ -9,6 +9,7 @@
 #include <stack>
 #include <string>
 #include <chrono>
+#include <functional>
 #include <mutex>
 #include "missing_link/types.hpp"
 #include "missing_link/display.hpp"
@@ -31,7 +32,8 @@ namespace MissingLink {
       MainView();
       virtual ~MainView();
 
-      void SetAnimationLEDs(const float frame[NumAnimLEDs]);
+      // Perceived brightness (0 - 1) of each ring LED, gamma corrected on output
+      void SetAnimationLEDs(const float levels[NumAnimLEDs]);
       void ClearAnimationLEDs();
 
       // Set a value to be immediately written to the display.
@@ -50,8 +52,14 @@ namespace MissingLink {
       // Update the display.
       void UpdateDisplay();
 
-      // Draw a frame of the WiFi Status LED
-      void displayWifiStatusFrame(float frame);
+      // Draw a frame of the WiFi Status LED, perceived brightness (0 - 1)
+      void displayWifiStatusFrame(float level);
+
+      // Send the LED changes of this frame to the driver
+      void FlushLEDs();
+
+      // Called from the I2C bus thread whenever a new display frame was sent
+      void OnDisplaySent(std::function<void()> handler);
 
       void setLogoLight(double phase);
 
@@ -62,10 +70,9 @@ namespace MissingLink {
       TimePoint m_tempMessageExpiration;
       std::stack<std::string> m_tempDisplayValues;
       std::string m_displayValue;
-      std::string m_tempScrollingMessage;
+      Marquee m_marquee;
       TimePoint m_lastTempMessageFrame;
       bool m_scrollTempMessage;
-      int m_scrollOffset;
 
       std::mutex m_displayMutex;
 
@@ -73,6 +80,7 @@ namespace MissingLink {
       std::unique_ptr<SegmentDisplay> m_pDisplay;
 
       std::unique_ptr<GPIO::Pin> m_pLogoLight;
+      int m_logoLightState;   // last value written, -1 before the first
 
       double m_addLedBrightness;
   };
@@ -3,19 +3,43 @@
  * Circuit Happy, LLC
  */
 
+#include <sys/inotify.h>
 #include "missing_link/wifi_status.hpp"
 
 using namespace MissingLink;
 using namespace MissingLink::FileIO;
 
 WifiStatus::WifiStatus()
-  : m_pWifiStatusFile(std::unique_ptr<TextFile>(new TextFile(wifiStatusFile)))
+  : m_pWifiStatusFile(std::unique_ptr<TextFile>(new TextFile(wifiStatusDir + "/" + wifiStatusName)))
+  , m_status(NO_WIFI_FOUND)
 {
 }
 
 WifiStatus::~WifiStatus() {}
 
 WifiState WifiStatus::ReadStatus() {
+  WifiState status = parseStatus();
+  m_status = status;
+  return status;
+}
+
+void WifiStatus::Watch(Reactor &reactor, std::function<void(WifiState)> onChanged) {
+  auto check = [this, onChanged]() {
+    WifiState previous = m_status;
+    if (ReadStatus() != previous && onChanged) {
+      onChanged(m_status);
+    }
+  };
+  // Watch the directory rather than the file, the file may be replaced
+  // by a rename and a watch on it would be lost
+  const std::string name = wifiStatusName;
+  reactor.WatchPath(wifiStatusDir, IN_CLOSE_WRITE | IN_MOVED_TO, [name, check](const std::string &changed, uint32_t) {
+    if (changed == name) { check(); }
+  });
+  check();
+}
+
+WifiState WifiStatus::parseStatus() {
   std::string strState = m_pWifiStatusFile->Read();
   if (strState == "WIFI_CONNECTED") {
       return WIFI_CONNECTED;
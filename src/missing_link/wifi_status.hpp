@@ -5,10 +5,13 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <string>
 #include <iostream>
 #include "missing_link/file_io.hpp"
+#include "missing_link/reactor.hpp"
 
 namespace MissingLink {
 
@@ -27,10 +30,23 @@ enum WifiState {
       WifiStatus();
       virtual ~WifiStatus();
 
+      // Parse the status file and remember the result
       WifiState ReadStatus();
 
+      // Last status read, safe from any thread
+      WifiState GetStatus() const { return m_status.load(); }
+
+      // Re-read the status whenever the file is rewritten or replaced,
+      // instead of polling it. onChanged is called on the reactor thread,
+      // only when the status actually changed.
+      void Watch(Reactor &reactor, std::function<void(WifiState)> onChanged);
+
     private:
-      std::string wifiStatusFile = "/tmp/WifiStatus";
+      std::string wifiStatusDir = "/tmp";
+      std::string wifiStatusName = "WifiStatus";
       std::unique_ptr<FileIO::TextFile> m_pWifiStatusFile;
+      std::atomic<WifiState> m_status;
+
+      WifiState parseStatus();
   };
 }